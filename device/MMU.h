@@ -30,4 +30,11 @@ void mmu_set_ptr1( uint32_t* x );
 // configure MMU: set 2-bit permission field of domain d to x
 void mmu_set_dom( int d, uint8_t x );
 
+//  enable L1 I- and D-caches, and branch prediction
+void cache_enable();
+// invalidate L1 I- and D-caches, and branch predictor
+void cache_invalidate();
+// clean   the D-cache line holding address x out to memory
+void cache_clean_line( void* x );
+
 #endif
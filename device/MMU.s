@@ -32,6 +32,10 @@
 	
 .global mmu_set_dom
 
+.global cache_enable
+.global cache_invalidate
+.global cache_clean_line
+
 mmu_enable:          mrc   p15, 0, r0, c1, c0, 0 @ read  SCTLR
                      orr   r0, r0, #0x1          @ set   SCTLR[ M ] = 1 => MMU  enable
                      mcr   p15, 0, r0, c1, c0, 0 @ write SCTLR
@@ -69,3 +73,51 @@ mmu_set_dom:         add   r0, r0, r0            @ compute i (index      from do
 
                      mov   pc, lr                @ return
 
+cache_enable:        mrc   p15, 0, r0, c1, c0, 0 @ read  SCTLR
+                     orr   r0, r0, #0x4          @ set   SCTLR[ C ] = 1 => D-cache enable
+                     orr   r0, r0, #0x800        @ set   SCTLR[ Z ] = 1 => branch prediction enable
+                     orr   r0, r0, #0x1000       @ set   SCTLR[ I ] = 1 => I-cache enable
+                     mcr   p15, 0, r0, c1, c0, 0 @ write SCTLR
+                     isb
+
+                     mov   pc, lr                @ return
+
+/* The L1 caches come out of reset holding garbage (on the A9 at least), so
+ * must be invalidated before they are enabled. The D-cache has no invalidate
+ * all operation, so is invalidated line by line, by set and way, using the
+ * geometry in CCSIDR.
+ */
+
+cache_invalidate:    push  { r4-r7 }
+                     mov   r0, #0x0
+                     mcr   p15, 0, r0, c7, c5, 0 @ write ICIALLU => invalidate I-cache
+                     mcr   p15, 0, r0, c7, c5, 6 @ write BPIALL  => invalidate branch predictor
+                     mcr   p15, 2, r0, c0, c0, 0 @ write CSSELR  => select L1 D-cache
+                     isb
+                     mrc   p15, 1, r1, c0, c0, 0 @ read  CCSIDR
+                     and   r2, r1, #0x7
+                     add   r2, r2, #4            @ compute log2( line length )
+                     ldr   r3, =0x3FF
+                     and   r3, r3, r1, lsr #3    @ compute ways - 1
+                     ldr   r4, =0x7FFF
+                     and   r4, r4, r1, lsr #13   @ compute sets - 1
+                     clz   r5, r3                @ compute way field shift
+
+l_way:               mov   r6, r4                @ for each way, from the last ...
+l_set:               mov   r7, r3, lsl r5        @ ... and each set, from the last
+                     orr   r7, r7, r6, lsl r2
+                     mcr   p15, 0, r7, c7, c6, 2 @ write DCISW   => invalidate line
+                     subs  r6, r6, #1
+                     bge   l_set
+                     subs  r3, r3, #1
+                     bge   l_way
+
+                     dsb
+                     isb
+                     pop   { r4-r7 }
+                     mov   pc, lr                @ return
+
+cache_clean_line:    mcr   p15, 0, r0, c7, c10, 1 @ write DCCMVAC => clean line holding x
+                     dsb
+
+                     mov   pc, lr                @ return
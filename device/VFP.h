@@ -0,0 +1,43 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __VFP_H
+#define __VFP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device.h"
+
+/* The VFP/NEON unit shares one register file, of 32 64-bit D-registers (which
+ * NEON also sees as 16 128-bit Q-registers) plus the FPSCR status and control
+ * register. While FPEXC[ EN ] is clear any VFP or NEON instruction is
+ * undefined, which lets the kernel notice the first use of the unit.
+ */
+
+typedef struct {
+  uint64_t d[ 32 ];
+  uint32_t fpscr;
+} vfp_t;
+
+// allow VFP/NEON access (in CPACR) from every mode, but leave the unit disabled
+void vfp_init();
+
+//  enable the VFP/NEON unit: set FPEXC[ EN ]
+void vfp_enable();
+// disable the VFP/NEON unit, so that its first use traps
+void vfp_unable();
+// is the VFP/NEON unit enabled?
+bool vfp_enabled();
+
+// save    the VFP/NEON registers into x
+void vfp_save( vfp_t* x );
+// restore the VFP/NEON registers from x
+void vfp_load( vfp_t* x );
+
+#endif
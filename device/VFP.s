@@ -0,0 +1,65 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+/* Section B1.11 of
+ *
+ * http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.ddi0406c/index.html
+ *
+ * covers enabling the VFP/NEON unit: co-processors 10 and 11 must first be
+ * granted access in CPACR, after which FPEXC[ EN ] turns the unit itself on
+ * and off. Both the A8 and A9 implement VFPv3 with all 32 D-registers.
+ */
+
+.fpu neon
+
+.global vfp_init
+
+.global vfp_enable
+.global vfp_unable
+.global vfp_enabled
+
+.global vfp_save
+.global vfp_load
+
+vfp_init:            mrc   p15, 0, r0, c1, c0, 2 @ read  CPACR
+                     orr   r0, r0, #0xF00000     @ set   CPACR[ cp10, cp11 ] = 0b11 => full access
+                     mcr   p15, 0, r0, c1, c0, 2 @ write CPACR
+                     isb
+                     mov   r0, #0x0
+                     vmsr  fpexc, r0             @ write FPEXC => unit disabled
+
+                     mov   pc, lr                @ return
+
+vfp_enable:          mov   r0, #0x40000000
+                     vmsr  fpexc, r0             @ set   FPEXC[ EN ] = 1 => unit enable
+
+                     mov   pc, lr                @ return
+
+vfp_unable:          mov   r0, #0x0
+                     vmsr  fpexc, r0             @ set   FPEXC[ EN ] = 0 => unit disable
+
+                     mov   pc, lr                @ return
+
+vfp_enabled:         vmrs  r0, fpexc             @ read  FPEXC
+                     lsr   r0, r0, #30
+                     and   r0, r0, #0x1          @ extract FPEXC[ EN ]
+
+                     mov   pc, lr                @ return
+
+vfp_save:            vstmia r0!, { d0-d15  }     @ store D-registers
+                     vstmia r0!, { d16-d31 }
+                     vmrs  r1, fpscr             @ read  FPSCR
+                     str   r1, [ r0 ]
+
+                     mov   pc, lr                @ return
+
+vfp_load:            vldmia r0!, { d0-d15  }     @ load  D-registers
+                     vldmia r0!, { d16-d31 }
+                     ldr   r1, [ r0 ]
+                     vmsr  fpscr, r1             @ write FPSCR
+
+                     mov   pc, lr                @ return
@@ -10,24 +10,66 @@
 char wd[256];
 
 // PROCESS MANAGEMENT
-pcb_t pcb[PCB_SIZE];
-
-uint32_t pcballoc   =  0;
-pid_t current       = -1;
-
-#if !SCHEDULE_AGES
-int current_runtime =  0;
-#endif
+// PCBs are allocated a chunk at a time, as needed, and never move
+pcb_t*   pcb_chunks[PCB_MAX / PCB_CHUNK] = {NULL};
+// Bit i of the bitmap set iff PCB slot i is in use
+uint32_t pcballoc[PCB_MAX / 32] = {0};
+// Generation of each slot, bumped on reuse to tag PIDs
+uint32_t pcbgen[PCB_MAX] = {0};
+// Processes in the table
+int      nprocs = 0;
+
+// CORES
+cpu_t    cpus[NCPU];
+// Bit i set iff core i is up / running its idle task
+uint32_t online_mask = 0;
+uint32_t idle_mask   = 0;
+// What the idle tasks run in: nothing but the kernel
+proc_t   kernel_proc;
+// The context each core's IRQ and SVC handlers save into and restore from:
+// that of the process it is running
+ctx_t*   lolevel_ctx[NCPU] = {NULL};
+
+// LOCKS
+// Taken in this order, each optional: file_lock, sem_lock, proc_lock, a slab
+// cache's lock, heap_lock
+// Open file table, pipe table and file system
+spinlock_t file_lock = SPINLOCK_INIT;
+// Semaphores
+spinlock_t sem_lock  = SPINLOCK_INIT;
+// PCB table, ready and wait queues, cores, timers and tty buffers
+spinlock_t proc_lock = SPINLOCK_INIT;
+// newlib's malloc
+spinlock_t heap_lock = SPINLOCK_INIT;
 
 // SEMAPHORES
-sem_t sem[PCB_SIZE] = {0};
+sem_t sem[SEM_COUNT] = {0};
+// Named semaphores, by slot and by name
+sem_t*   named_sems[SEM_NAMED_MAX] = {NULL};
+// Generation of each slot, bumped on reuse to tag IDs
+uint32_t named_gen[SEM_NAMED_MAX]  = {0};
+sem_t* sem_hash[SEM_HASH_SIZE] = {NULL};
+// FUTEXES
+waitq_t futexq[FUTEX_BUCKETS] = {{0}};
 // PIPES
-pipe_t* pipes[PCB_SIZE] = {NULL};
+pipe_t* pipes[PIPE_COUNT] = {NULL};
+// TTYS
+// Only UART0 backs kernel file descriptors; the shells drive UART1 directly
+tty_t tty0;
+
+// OBJECT CACHES
+// The kernel's fixed-size objects, so system calls need not go to the heap
+slab_t fdte_cache;
+slab_t pipe_cache;
+slab_t path_cache;
+slab_t vfp_cache;
+slab_t sem_cache;
+slab_t proc_cache;
 
 // FILE STUFF
 fs2_volume_t vol;
 
-fdte_t* openft[64] = {NULL};
+fdte_t* openft[FT_SIZE] = {NULL};
 
 // USER PROGRAMS
 extern void main_P1();
@@ -49,6 +91,10 @@ extern uint32_t _heap_end;
 
 caddr_t brk = (caddr_t) &end;
 
+//newlib calls these around every malloc/free (and so every _sbrk)
+void __malloc_lock  (struct _reent* r) { spin_lock  (&heap_lock); }
+void __malloc_unlock(struct _reent* r) { spin_unlock(&heap_lock); }
+
 caddr_t _sbrk( int incr ) {
   caddr_t prev = brk;
   caddr_t new = brk + incr;
@@ -86,9 +132,6 @@ void k_print_int(int x) {
   }
 }
 
-uint32_t top_of(stack_area_t* stack) {
-  return (uint32_t) stack + sizeof(stack_area_t);
-}
 
 ////////////////////////////////////////////
 //   VIRTUAL FILE SYSTEM  &  FILE TABLE   //
@@ -113,7 +156,7 @@ char* abs_path_r(char* path, char* wd) {
 }
 
 char* abs_path(char* path) {
-  return abs_path_r(path, pcb[current].wd);
+  return abs_path_r(path, current->proc->wd);
 }
 
 fmode_t fmode_from_flags(char flags) {
@@ -129,42 +172,730 @@ fmode_t fmode_from_flags(char flags) {
 //    PROCESS MANAGEMENT    //
 //////////////////////////////
 
+bool slot_used(int i) {
+  return (pcballoc[i / 32] >> (i % 32)) & 1;
+}
+
+pcb_t* slot_pcb(int i) {
+  return &pcb_chunks[i / PCB_CHUNK][i % PCB_CHUNK];
+}
+
+//The PID slot i hands out to its current occupant
+pid_t slot_pid(int i) {
+  return ((pcbgen[i] & 0xFFFFF) << PID_SLOT_BITS) | i;
+}
+
+int pid_slot(pid_t pid) {
+  return pid & (PCB_MAX - 1);
+}
+
+//The first thread of process pid, which stands for it until it has finished
+//(even if the thread itself has), or NULL if it has
+pcb_t* proc_of(pid_t pid) {
+  if (pid < 0) return NULL;
+  int i = pid_slot(pid);
+  if (!slot_used(i) || slot_pcb(i)->pid != pid) return NULL;
+  //Zombies are only left to be waited for
+  if (slot_pcb(i)->zombie) return NULL;
+  return slot_pcb(i);
+}
+
+//The PCB standing for process pr: that of its first thread
+pcb_t* proc_pcb(proc_t* pr) {
+  return slot_pcb(pid_slot(pr->pid));
+}
+
+//The process with PID given, or NULL if there is none (any more)
+pcb_t* pcb_of(pid_t pid) {
+  pcb_t* p = proc_of(pid);
+  //A first thread kept for its process's sake has finished all the same
+  return p == NULL || p->proc == NULL ? NULL : p;
+}
+
 //True iff there is a process with PID given
 bool process_exists(pid_t pid) {
-  return ((pcballoc >> pid) & 1);
+  return pcb_of(pid) != NULL;
 }
 
 //Returns true iff there is a process with PID given AND its status is one of
 //CREATED and READY
 bool process_can_run(pid_t pid) {
-  return process_exists(pid) && pcb[pid].status < STATUS_EXECUTING;
+  return process_exists(pid) && pcb_of(pid)->status < STATUS_EXECUTING;
+}
+
+/////
+////  READY QUEUES
+///
+// A process is on a ready queue iff it is CREATED or READY; the executing
+// process is not queued. Status changes go through make_ready/rq_dequeue
+// rather than the scheduler polling the PCB table for runnable processes.
+// Each core has its own ready queue; all of them are under proc_lock.
+
+// Timer ticks since boot
+uint32_t ticks = 0;
+
+bool is_idle(pcb_t* p) {
+  return p->pid == IDLE_PID;
+}
+
+//The priority p is scheduled at: its own, or one it has inherited
+int priority(pcb_t* p) {
+  return p->inherited > p->base_priority ? p->inherited : p->base_priority;
+}
+
+/////
+////  POLICIES
+///
+// Each policy keeps its processes in a part of the ready queue of its own,
+// behind a sched_ops_t, and decides for itself when the running process has
+// had its turn. A process can be switched between them at any time.
+
+//A FIFO per level, plus a bitmap with bit i set iff level i is non-empty, so
+//the highest non-empty level is found with one CLZ
+void levels_add(rq_levels_t* q, int l, pcb_t* p) {
+  p->rq_next = NULL;
+  p->rq_prev = q->tail[l];
+  if (q->tail[l] != NULL) q->tail[l]->rq_next = p;
+  else                    q->head[l]          = p;
+  q->tail[l] = p;
+  q->bitmap |= (1 << l);
+}
+
+void levels_remove(rq_levels_t* q, int l, pcb_t* p) {
+  if (p->rq_prev != NULL) p->rq_prev->rq_next = p->rq_next;
+  else                    q->head[l]          = p->rq_next;
+  if (p->rq_next != NULL) p->rq_next->rq_prev = p->rq_prev;
+  else                    q->tail[l]          = p->rq_prev;
+  if (q->head[l] == NULL) q->bitmap &= ~(1 << l);
+}
+
+//Highest non-empty level in a non-zero bitmap
+int rq_top(uint32_t bitmap) {
+  return 31 - __builtin_clz(bitmap);
+}
+
+int rq_level(pcb_t* p) {
+  return priority(p) > PRIORITY_MAX ? PRIORITY_MAX : priority(p);
+}
+
+/////
+////  Weighted round-robin: every process gets its priority's worth of ticks
+///   in turn, so all share one level
+
+void rr_enqueue(runq_t* rq, pcb_t* p) {
+  levels_add(&rq->rr, 0, p);
+}
+
+void rr_dequeue(runq_t* rq, pcb_t* p) {
+  levels_remove(&rq->rr, 0, p);
+}
+
+pcb_t* rr_pick_next(runq_t* rq) {
+  return rq->rr.head[0];
+}
+
+bool rr_tick(cpu_t* cpu, pcb_t* cur, pcb_t* next) {
+  bool expired = cpu->runtime >= priority(cur);
+  //Whether or not anyone takes over, a new quantum starts
+  if (expired) cpu->runtime = 0;
+  cpu->runtime++;
+  return expired;
+}
+
+/////
+////  Priority ageing: a queued process's priority rises by one each tick it
+///   waits, and resets when it runs
+
+int aged_priority(pcb_t* p) {
+  return priority(p) + (ticks - p->enqueued_at);
+}
+
+void aged_enqueue(runq_t* rq, pcb_t* p) {
+  levels_add(&rq->aged, rq_level(p), p);
+}
+
+void aged_dequeue(runq_t* rq, pcb_t* p) {
+  levels_remove(&rq->aged, rq_level(p), p);
+}
+
+//Each level is FIFO, so its head is also its oldest (i.e. most aged) member:
+//only the heads of the non-empty levels need comparing, at most RQ_LEVELS
+pcb_t* aged_pick_next(runq_t* rq) {
+  pcb_t*   best = NULL;
+  uint32_t bits = rq->aged.bitmap;
+  while (bits) {
+    int l = rq_top(bits);
+    bits &= ~(1 << l);
+    if (best == NULL || aged_priority(rq->aged.head[l]) > aged_priority(best))
+      best = rq->aged.head[l];
+  }
+  return best;
+}
+
+//The current process was aged 0 when chosen and does not age while
+//executing, so its aged priority is its base
+bool aged_tick(cpu_t* cpu, pcb_t* cur, pcb_t* next) {
+  return next != NULL && aged_priority(next) > priority(cur);
+}
+
+/////
+////  Completely fair: the least-served process (by vruntime) runs next
+
+//Weights by priority, each level's 1.25 times the one below's, so that a
+//process gets about 25% more CPU time than one a level less important
+const uint32_t fair_weights[RQ_LEVELS] = {
+      335,    423,    526,    655,    820,   1024,   1277,   1586,
+     1991,   2501,   3121,   3906,   4904,   6100,   7620,   9548,
+    11916,  14949,  18705,  23254,  29154,  36291,  46273,  56483,
+    71755,  88761, 110951, 138689, 173361, 216701, 270876, 338595
+};
+
+uint32_t weight(pcb_t* p) {
+  int pr = priority(p);
+  return fair_weights[pr < 0 ? 0 : pr > PRIORITY_MAX ? PRIORITY_MAX : pr];
+}
+
+bool is_fair(pcb_t* p) {
+  return p->policy == SCHED_FAIR && !is_idle(p);
+}
+
+//vruntimes only ever move forwards, so compare them by their difference
+bool vruntime_less(rb_node_t* a, rb_node_t* b) {
+  return (int64_t) (rb_entry(a, pcb_t, rq_node)->vruntime
+                  - rb_entry(b, pcb_t, rq_node)->vruntime) < 0;
+}
+
+void fair_enqueue(runq_t* rq, pcb_t* p) {
+  rb_insert(&rq->fair, &p->rq_node, &vruntime_less);
+}
+
+void fair_dequeue(runq_t* rq, pcb_t* p) {
+  rb_erase(&rq->fair, &p->rq_node);
+}
+
+//The least served, at the left of the tree
+pcb_t* fair_pick_next(runq_t* rq) {
+  if (rq->fair.first == NULL) return NULL;
+  return rb_entry(rq->fair.first, pcb_t, rq_node);
+}
+
+//cur runs on until it has had FAIR_GRANULARITY more (weighted) CPU time than
+//next, so heavier processes run for proportionally longer between switches
+bool fair_tick(cpu_t* cpu, pcb_t* cur, pcb_t* next) {
+  return next != NULL 
+      && (int64_t) (cur->vruntime - next->vruntime) > FAIR_GRANULARITY;
+}
+
+//Raise rq's floor to the least vruntime on its core: that of the queue's
+//first fair process or, if less, of cur, running there
+void update_min_vruntime(runq_t* rq, pcb_t* cur) {
+  pcb_t* first = fair_pick_next(rq);
+  uint64_t v;
+  if (is_fair(cur)) {
+    v = cur->vruntime;
+    if (first != NULL && (int64_t) (first->vruntime - v) < 0) v = first->vruntime;
+  }
+  else if (first != NULL) v = first->vruntime;
+  else return;
+  if ((int64_t) (v - rq->min_vruntime) > 0) rq->min_vruntime = v;
+}
+
+//Carry p's vruntime over from queue from to rq, each being relative to its
+//own floor. Newcomers start level with rq's floor; a process that has been
+//asleep gets to be up to FAIR_SLEEPER_CREDIT behind it.
+void fair_place(runq_t* rq, runq_t* from, pcb_t* p, status_t stat) {
+  p->vruntime += rq->min_vruntime - from->min_vruntime;
+  uint64_t floor = rq->min_vruntime;
+  if (stat == STATUS_READY) floor -= FAIR_SLEEPER_CREDIT;
+  if ((int64_t) (p->vruntime - floor) < 0) p->vruntime = floor;
+}
+
+/////
+////  Earliest deadline first: the real-time process whose current job is
+///   due soonest runs next
+
+//Deadlines wrap with the clock, so compare them by their difference
+bool due_before(pcb_t* a, pcb_t* b) {
+  return (int32_t) (a->rt.due - b->rt.due) < 0;
+}
+
+bool due_less(rb_node_t* a, rb_node_t* b) {
+  return due_before(rb_entry(a, pcb_t, rq_node), rb_entry(b, pcb_t, rq_node));
+}
+
+void edf_enqueue(runq_t* rq, pcb_t* p) {
+  rb_insert(&rq->edf, &p->rq_node, &due_less);
+}
+
+void edf_dequeue(runq_t* rq, pcb_t* p) {
+  rb_erase(&rq->edf, &p->rq_node);
+}
+
+pcb_t* edf_pick_next(runq_t* rq) {
+  if (rq->edf.first == NULL) return NULL;
+  return rb_entry(rq->edf.first, pcb_t, rq_node);
+}
+
+bool edf_preempt(pcb_t* cur, pcb_t* next) {
+  return due_before(next, cur);
+}
+
+//Budgets are enforced by the real-time event timer, not the tick
+bool edf_tick(cpu_t* cpu, pcb_t* cur, pcb_t* next) {
+  return next != NULL && edf_preempt(cur, next);
+}
+
+sched_ops_t sched_rr   = { "rr",   1, false, &rr_enqueue,   &rr_dequeue,
+                                      &rr_pick_next,   &rr_tick,   NULL };
+sched_ops_t sched_aged = { "ages", 2, false, &aged_enqueue, &aged_dequeue,
+                                      &aged_pick_next, &aged_tick, NULL };
+sched_ops_t sched_fair = { "fair", 3, false, &fair_enqueue, &fair_dequeue,
+                                      &fair_pick_next, &fair_tick, NULL };
+sched_ops_t sched_edf  = { "edf",  0, true,  &edf_enqueue,  &edf_dequeue,
+                                      &edf_pick_next,  &edf_tick,  &edf_preempt };
+//By ID
+sched_ops_t* policies[SCHED_POLICIES] = 
+  { &sched_rr, &sched_aged, &sched_fair, &sched_edf };
+// The policy new processes without a parent (and, once set, every process)
+// are scheduled by
+int sched_default = SCHED_DEFAULT;
+// The real-time processes, in no particular order
+pcb_t* rt_procs[EDF_MAX];
+int    rt_count = 0;
+
+#define sched_of(p) (policies[(p)->policy])
+
+// Bandwidth groups, by ID. Group 0 always exists
+group_t groups[GROUP_MAX] = { [0] = { .used = true } };
+
+/////
+////  WAIT QUEUES
+///
+// A process blocked on an event (e.g. data arriving in a pipe) sits on that
+// event's wait queue, WAITING, until woken by whoever causes it. All wait
+// queues are under proc_lock.
+
+void wq_add(waitq_t* wq, pcb_t* p) {
+  p->rq_next = NULL;
+  p->rq_prev = wq->tail;
+  if (wq->tail != NULL) wq->tail->rq_next = p;
+  else                  wq->head          = p;
+  wq->tail = p;
+  p->wq    = wq;
+}
+
+//Take p off whichever wait queue it is on, if any
+void wq_remove(pcb_t* p) {
+  waitq_t* wq = p->wq;
+  if (wq == NULL) return;
+  if (p->rq_prev != NULL) p->rq_prev->rq_next = p->rq_next;
+  else                    wq->head            = p->rq_next;
+  if (p->rq_next != NULL) p->rq_next->rq_prev = p->rq_prev;
+  else                    wq->tail            = p->rq_prev;
+  p->rq_next = p->rq_prev = NULL;
+  p->wq      = NULL;
+}
+
+/////
+////  BANDWIDTH GROUPS
+///
+// A group's CPU time is counted per period, from when it was created. Each
+// tick checks whether the running process's group has had its quota: if so,
+// the group is throttled, and its members parked on it, WAITING, until its
+// timer fires for the next period. Real-time processes are held to their
+// own budgets instead, so are never parked.
+
+//Add p to group gid's members
+void group_enter(pcb_t* p, int gid) {
+  spin_lock(&proc_lock);
+  group_t* g    = &groups[gid];
+  p->group      = gid;
+  p->group_prev = NULL;
+  p->group_next = g->first;
+  if (g->first != NULL) g->first->group_prev = p;
+  g->first = p;
+  g->members++;
+  spin_unlock(&proc_lock);
+}
+
+//Take p out of its group's members
+void group_leave(pcb_t* p) {
+  spin_lock(&proc_lock);
+  group_t* g = &groups[p->group];
+  if (p->group_prev != NULL) p->group_prev->group_next = p->group_next;
+  else                       g->first                  = p->group_next;
+  if (p->group_next != NULL) p->group_next->group_prev = p->group_prev;
+  p->group_next = p->group_prev = NULL;
+  g->members--;
+  spin_unlock(&proc_lock);
+}
+
+//Whether p is held back by its group
+bool group_holds(pcb_t* p) {
+  return groups[p->group].throttled && p->policy != SCHED_EDF;
+}
+
+//Park p, which must be on no queue, until its group is released
+void group_park(pcb_t* p) {
+  p->status = STATUS_WAITING;
+  wq_add(&groups[p->group].parked, p);
+}
+
+//Move g on to the period now is in, if it is not there already. Any time it
+//ran over its quota by is carried over, as a debt.
+void group_advance(group_t* g, uint32_t now) {
+  uint32_t periods = (now - g->start) / g->period;
+  if (periods == 0) return;
+  g->start += periods * g->period;
+  uint64_t quota = (uint64_t) g->quota * periods;
+  g->runtime = g->runtime > quota ? g->runtime - quota : 0;
+}
+
+//Charge g for the delta µs of its members' CPU time up to now
+void group_charge(group_t* g, uint32_t now, uint32_t delta) {
+  g->usage += delta;
+  if (g->quota == 0) return;
+  group_advance(g, now);
+  g->runtime += delta;
+}
+
+/////
+////  READY QUEUES (cont.)
+///
+
+void rq_enqueue(runq_t* rq, pcb_t* p) {
+  //Its group is out of quota: it waits for the next period instead
+  if (group_holds(p)) {
+    group_park(p);
+    return;
+  }
+  sched_of(p)->enqueue(rq, p);
+  rq->count++;
+  p->rq          = rq;
+  p->enqueued_at = ticks;
+}
+
+//Take p off whichever ready queue it is on, if any
+void rq_dequeue(pcb_t* p) {
+  runq_t* rq = p->rq;
+  if (rq == NULL) return;
+  sched_of(p)->dequeue(rq, p);
+  rq->count--;
+  p->rq_next = p->rq_prev = NULL;
+  p->rq      = NULL;
 }
 
-void context_switch(pcb_t* from, pcb_t* new, ctx_t* ctx, status_t from_stat) {
+//Charge the process running on cpu for the CPU time since it last was
+void account(cpu_t* cpu) {
+  uint32_t now   = timer_now();
+  uint32_t delta = now - cpu->exec_start;
+  pcb_t*   p     = cpu->running;
+  cpu->exec_start = now;
+  if (p == NULL || is_idle(p)) return;
+  p->cputime += delta;
+  group_charge(&groups[p->group], now, delta);
+  if (is_fair(p)) {
+    //Keeps delta * NICE_0_WEIGHT within 32 bits
+    if (delta > 0x3FFFFF) delta = 0x3FFFFF;
+    p->vruntime += delta * NICE_0_WEIGHT / weight(p);
+    update_min_vruntime(&cpu->runq, p);
+  }
+  if (p->policy == SCHED_EDF) p->rt.used += delta;
+}
+
+//Mark p runnable and queue it: on the core it last ran on, unless that core
+//is busy and another is idle (and p's policy lets it move), in which case it
+//goes to the idle one
+void make_ready(pcb_t* p, status_t stat) {
+  spin_lock(&proc_lock);
+  int      c    = p->cpu;
+  uint32_t idle = idle_mask & online_mask;
+  if (!((online_mask >> c) & 1)) c = cpu_id();
+  if (!((idle >> c) & 1) && idle && !sched_of(p)->pinned) 
+    c = __builtin_ctz(idle);
+
+  p->status = stat;
+  if (is_fair(p)) fair_place(&cpus[c].runq, &cpus[p->cpu].runq, p, stat);
+  p->cpu    = c;
+  rq_enqueue(&cpus[c].runq, p);
+  //The local core reschedules on its way out of the kernel anyway
+  if (c != cpu_id()) sgi_send(1 << c, SGI_RESCHED);
+  spin_unlock(&proc_lock);
+}
+
+//The process that should run next, without dequeuing it: that of the
+//highest-ranked policy with any queued. Only those that may move to another
+//core, if movable.
+pcb_t* rq_best(runq_t* rq, bool movable) {
+  pcb_t* best = NULL;
+  for (int i = 0; i < SCHED_POLICIES; ++i) {
+    if (movable && policies[i]->pinned) continue;
+    if (best != NULL && policies[i]->rank >= sched_of(best)->rank) continue;
+    pcb_t* p = policies[i]->pick_next(rq);
+    if (p != NULL) best = p;
+  }
+  return best;
+}
+
+//Move p onto policy pol, and its queue with it
+void set_policy(pcb_t* p, int pol) {
+  spin_lock(&proc_lock);
+  runq_t* rq = p->rq;
+  rq_dequeue(p);
+  //Its vruntime is stale, if it has one at all: start level with the rest
+  if (pol == SCHED_FAIR && p->policy != SCHED_FAIR)
+    p->vruntime = cpus[p->cpu].runq.min_vruntime;
+  p->policy = pol;
+  if (rq != NULL) rq_enqueue(rq, p);
+  spin_unlock(&proc_lock);
+}
+
+//Find work for a core with none of its own: the best process queued on
+//the busiest other core
+pcb_t* steal() {
+  cpu_t* victim = NULL;
+  for (int c = 0; c < NCPU; ++c) {
+    if (c == cpu_id() || !((online_mask >> c) & 1)) continue;
+    if (cpus[c].runq.count > (victim == NULL ? 0 : victim->runq.count))
+      victim = &cpus[c];
+  }
+  return victim == NULL ? NULL : rq_best(&victim->runq, true);
+}
+
+//Processes queued on any core
+int queued() {
+  int n = 0;
+  for (int c = 0; c < NCPU; ++c) n += cpus[c].runq.count;
+  return n;
+}
+
+/////
+////  PRIORITY INHERITANCE
+///
+// A process holding a mutex runs at (at least) the priority of the most
+// important process waiting for it, so that it is not kept from releasing it
+// by processes of middling priority.
+
+//Change what p inherits. A queued process has to move to its new level's queue
+void set_inherited(pcb_t* p, int pr) {
+  spin_lock(&proc_lock);
+  runq_t* rq = p->rq;
+  rq_dequeue(p);
+  p->inherited = pr;
+  if (rq != NULL) rq_enqueue(rq, p);
+  spin_unlock(&proc_lock);
+}
+
+//Recompute what p inherits, from every waiter on every mutex it holds
+void reinherit(pcb_t* p) {
+  #if PRIORITY_INHERITANCE
+  spin_lock(&proc_lock);
+  int pr = -1;
+  for (sem_t* m = p->held; m != NULL; m = m->held_next)
+    for (pcb_t* w = m->wq.head; w != NULL; w = w->rq_next)
+      if (priority(w) > pr) pr = priority(w);
+  if (pr != p->inherited) set_inherited(p, pr);
+  spin_unlock(&proc_lock);
+  #endif
+}
+
+//Lend priority pr, that of a process about to wait on s, to s's owner, and on
+//down the chain of mutexes it (and their owners) wait for in turn. The depth
+//limit guards against deadlocked cycles.
+void inherit(sem_t* s, int pr) {
+  #if PRIORITY_INHERITANCE
+  spin_lock(&proc_lock);
+  for (int depth = 0; depth < 8 && s != NULL && s->mutex; ++depth) {
+    pcb_t* o = pcb_of(s->owner);
+    if (o == NULL || priority(o) >= pr) break;
+    set_inherited(o, pr);
+    s = o->sem_on;
+  }
+  spin_unlock(&proc_lock);
+  #endif
+}
+
+//Mutex m has been taken by p: any remaining waiters lend it their priority
+void mutex_acquired(sem_t* m, pcb_t* p) {
+  spin_lock(&proc_lock);
+  m->owner     = p->pid;
+  m->held_next = p->held;
+  p->held      = m;
+  reinherit(p);
+  spin_unlock(&proc_lock);
+}
+
+//Mutex m is being given up, along with whatever its owner inherited through it
+void mutex_released(sem_t* m) {
+  spin_lock(&proc_lock);
+  pcb_t* o = pcb_of(m->owner);
+  m->owner = -1;
+  if (o != NULL) {
+    sem_t** h = &o->held;
+    while (*h != NULL && *h != m) h = &(*h)->held_next;
+    if (*h != NULL) *h = m->held_next;
+    reinherit(o);
+  }
+  spin_unlock(&proc_lock);
+}
+
+/////
+////  REAL TIME
+///
+// Each real-time process's jobs are released, and replenished with budget,
+// every period. Releases and budgets running out are events on the SP804's
+// TIMER1, which is kept set for the soonest of them, so neither waits for a
+// tick. A process out of budget, or that yields to say its job is done,
+// sleeps (throttled) until its next release.
+
+//Parts per mille of a core that a reservation needs, rounded up
+uint32_t rt_density(uint32_t budget, uint32_t deadline) {
+  return ((uint64_t) budget * 1000 + deadline - 1) / deadline;
+}
+
+//Whether real-time process p, running on cpu, has used its budget as of now
+bool rt_exhausted(pcb_t* p, cpu_t* cpu, uint32_t now) {
+  return (int32_t) (p->rt.used + (now - cpu->exec_start) - p->rt.budget) >= 0;
+}
+
+//Set TIMER1 for the next real-time event: a release, or a running real-time
+//process running out of budget
+void rt_arm() {
+  if (rt_count == 0) {
+    timer_rt_stop();
+    return;
+  }
+  uint32_t now     = timer_now();
+  int32_t  soonest = INT32_MAX;
+  for (int i = 0; i < rt_count; ++i) {
+    pcb_t*  p = rt_procs[i];
+    int32_t d = p->rt.release + p->rt.period - now;
+    if (d < soonest) soonest = d;
+  }
+  for (int c = 0; c < NCPU; ++c) {
+    pcb_t* p = cpus[c].running;
+    if (p == NULL || is_idle(p) || p->policy != SCHED_EDF) continue;
+    int32_t d = p->rt.budget - p->rt.used - (now - cpus[c].exec_start);
+    if (d < soonest) soonest = d;
+  }
+  timer_rt_oneshot(soonest > 0 ? soonest : 1);
+}
+
+//Give up p's reservation. Returns whether it was throttled, in which case
+//it is on no queue, and the caller must see to it
+bool rt_leave(pcb_t* p) {
+  for (int i = 0; i < rt_count; ++i) {
+    if (rt_procs[i] == p) {
+      rt_procs[i] = rt_procs[--rt_count];
+      break;
+    }
+  }
+  cpus[p->cpu].rt_density -= rt_density(p->rt.budget, p->rt.deadline);
+  bool throttled = p->rt.throttled;
+  p->rt.throttled = false;
+  if (rt_count == 0) timer_rt_stop();
+  return throttled;
+}
+
+/////
+////  IDLE
+///
+// Runs whenever no process can, sleeping the core until the next interrupt
+// rather than spinning.
+void idle() {
+  while (1) asm volatile( "wfi" );
+}
+
+void init_cpu(cpu_t* cpu) {
+  memset(cpu, 0, sizeof(cpu_t));
+  pcb_t* idle_pcb = &cpu->idle;
+  idle_pcb->pid           = IDLE_PID;
+  idle_pcb->status        = STATUS_READY;
+  idle_pcb->cpu           = cpu - cpus;
+  //Anything queued beats it, with or without ages
+  idle_pcb->base_priority = -1;
+  idle_pcb->inherited     = -1;
+  idle_pcb->ctx.cpsr      = 0x50;
+  idle_pcb->ctx.pc        = (uint32_t) &idle;
+  idle_pcb->ctx.sp        = (uint32_t) &cpu->idle_stack[0x40];
+  //Runs on its kernel stack, so has no need of any process's memory
+  kernel_proc.as          = kernel_as;
+  idle_pcb->proc          = &kernel_proc;
+  cpu->vfp_owner          = IDLE_PID;
+}
+
+#if TICKLESS_IDLE
+//Nothing can preempt the idle task, so while every core is idle there is no
+//need to tick: only wake up when the next timer is due. Any other interrupt
+//that makes a process ready will reschedule.
+void tick_idle() {
+  uint32_t at;
+  if (timer_next_due(&at)) {
+    int32_t delta = at - timer_now();
+    timer_oneshot(delta > 0 ? delta : 1);
+  }
+  else timer_stop();
+}
+#endif
+
+//Registers are already in from->ctx, saved there on entry to the kernel, so
+//switching is only a matter of restoring from new->ctx on the way out
+void context_switch(pcb_t* from, pcb_t* new, status_t from_stat) {
+  cpu_t* cpu = this_cpu();
+  spin_lock(&proc_lock);
+  account(cpu);
+  //The unit is only on if from used it this quantum, in which case its
+  //registers are live and must be kept; either way, new's first use traps
+  if (vfp_enabled()) {
+    if (from != NULL && from->vfp != NULL) {
+      vfp_save(from->vfp);
+      from->vfp_cpu = cpu_id();
+    }
+    vfp_unable();
+  }
   if (from != NULL) {
-    //Preserve context
-    memcpy(&from->ctx, ctx, sizeof(ctx_t));
     from->status = from_stat;
+    if (from_stat < STATUS_EXECUTING && !is_idle(from)) 
+      rq_enqueue(&cpu->runq, from);
   }
-  memcpy(ctx, &new->ctx, sizeof(ctx_t));
+  //Stolen from another core, so relative to that one's floor
+  if (is_fair(new) && new->rq != NULL && new->rq != &cpu->runq)
+    new->vruntime += cpu->runq.min_vruntime - ((runq_t*) new->rq)->min_vruntime;
+  rq_dequeue(new);
+  as_switch(&new->proc->as);
+  lolevel_ctx[cpu_id()] = &new->ctx;
   new->status = STATUS_EXECUTING;
-  current = new->pid;
+  new->cpu    = cpu_id();
+  cpu->running = new;
+  //Budgets only run down while their processes run
+  if (rt_count > 0) rt_arm();
+
+  uint32_t was_idle = idle_mask;
+  if (is_idle(new)) idle_mask |=  (1 << cpu_id());
+  else              idle_mask &= ~(1 << cpu_id());
+  #if TICKLESS_IDLE
+  //TIMER0 ticks for every core, so may only stop once they are all idle
+  if      (idle_mask == online_mask && was_idle != online_mask) tick_idle();
+  else if (idle_mask != online_mask && was_idle == online_mask) 
+    timer_periodic(INTERVAL);
+  #endif
+  spin_unlock(&proc_lock);
 }
 
-//Implements RR scheduling
-void next(ctx_t* ctx, status_t cur_stat) {
-  #if !SCHEDULE_AGES
-  current_runtime = 0;
-  #endif
-  int i = (current + 1) % PCB_SIZE;
-  while ( !process_can_run(i)
-          && i != current     )
-      i = (i + 1) % PCB_SIZE;
-  
-  //i is now the pcb index of the next program, or same as current if no other
-  //exists
-  if (i != current) {
-    context_switch(&pcb[current], &pcb[i], ctx, cur_stat);
+//Switch to the best queued process, if there is one
+void next(status_t cur_stat) {
+  cpu_t* cpu = this_cpu();
+  spin_lock(&proc_lock);
+  cpu->runtime = 0;
+  pcb_t* n = rq_best(&cpu->runq, false);
+  //Out of work here, and about to idle: look elsewhere
+  if (n == NULL && (cur_stat != STATUS_READY || is_idle(current))) n = steal();
+  //If the current process cannot carry on and nothing else can run, idle
+  if (n == NULL && cur_stat != STATUS_READY) n = &cpu->idle;
+
+  //n is now the next program, or NULL if no other can run
+  if (n != NULL && n != current) {
+    context_switch(current, n, cur_stat);
     #if PRINT_SWITCHES
     PL011_putc(UART0, '>', true);
   }
@@ -172,76 +903,254 @@ void next(ctx_t* ctx, status_t cur_stat) {
     PL011_putc(UART0, '|', true);
     #endif
   }
+  spin_unlock(&proc_lock);
 }
 
-#if SCHEDULE_AGES
-int aged_priority(pcb_t* p) {
-  return p->base_priority + p->age;
+//Whether a process queued here should take over from the current one at
+//once: being of a higher-ranked policy, or as their policy says
+bool should_preempt() {
+  pcb_t* n = rq_best(&this_cpu()->runq, false);
+  if (n == NULL || is_idle(current)) return n != NULL;
+  sched_ops_t* s = sched_of(current);
+  if (sched_of(n)->rank != s->rank) return sched_of(n)->rank < s->rank;
+  return s->preempt != NULL && sched_of(n) == s && s->preempt(current, n);
+}
+
+//The current process, real-time, is done until its next release
+void rt_throttle() {
+  spin_lock(&proc_lock);
+  current->rt.throttled = true;
+  next(STATUS_SLEEPING);
+  spin_unlock(&proc_lock);
+}
+
+//Handle TIMER1: release every real-time process whose next period has
+//begun, and stop any that have run out of budget
+void rt_event() {
+  spin_lock(&proc_lock);
+  uint32_t now = timer_now();
+  for (int i = 0; i < rt_count; ++i) {
+    pcb_t* p = rt_procs[i];
+    if ((int32_t) (now - (p->rt.release + p->rt.period)) < 0) continue;
+    //Skipping any periods missed altogether
+    while ((int32_t) (now - (p->rt.release + p->rt.period)) >= 0)
+      p->rt.release += p->rt.period;
+    runq_t* rq = p->rq;
+    rq_dequeue(p);
+    p->rt.due  = p->rt.release + p->rt.deadline;
+    //If it is running, it is charged from exec_start: only charge it for
+    //the time since now
+    p->rt.used = p->status == STATUS_EXECUTING 
+               ? -(now - cpus[p->cpu].exec_start) : 0;
+    if (rq != NULL) rq_enqueue(rq, p);
+    if (p->rt.throttled) {
+      p->rt.throttled = false;
+      make_ready(p, STATUS_READY);
+    }
+  }
+  for (int c = 0; c < NCPU; ++c) {
+    pcb_t* p = cpus[c].running;
+    if (c == cpu_id() || p == NULL || is_idle(p) || p->policy != SCHED_EDF)
+      continue;
+    //Others stop theirs on a tick of their own
+    if (rt_exhausted(p, &cpus[c], now)) sgi_send(1 << c, SGI_TICK);
+  }
+  if (current->policy == SCHED_EDF && !is_idle(current) 
+      && rt_exhausted(current, this_cpu(), now)) rt_throttle();
+  rt_arm();
+  spin_unlock(&proc_lock);
 }
-//Implements priority-aging scheduling
-void schedule(ctx_t* ctx) {
 
-  int new = current;
-  for (int i = (current + 1) % PCB_SIZE; i != current; i = (i + 1) % PCB_SIZE) {
-    if (process_can_run(i)) { //Don't consider waiting processes
-      pcb[i].age++;
-      if (aged_priority(&pcb[i]) > aged_priority(&pcb[new])) new = i;
+//Hold g's members back until its next period: park those that are queued,
+//and have any running on other cores park themselves on their next tick
+void group_throttle(group_t* g, uint32_t now) {
+  spin_lock(&proc_lock);
+  g->throttled    = true;
+  g->throttled_at = now;
+  g->throttles++;
+  for (pcb_t* p = g->first; p != NULL; p = p->group_next) {
+    if (!group_holds(p)) continue;
+    if (p->rq != NULL) {
+      rq_dequeue(p);
+      group_park(p);
     }
+    else if (p->status == STATUS_EXECUTING && p->cpu != cpu_id()) 
+      sgi_send(1 << p->cpu, SGI_TICK);
   }
+  timer_add(&g->timer, g->start + g->period - now);
+  spin_unlock(&proc_lock);
+}
 
-  if (new != current) {
-    pcb[new].age = 0;
-    context_switch(&pcb[current], &pcb[new], ctx, STATUS_READY);
+//Called every tick. The current process makes way for any queued process of
+//a higher-ranked policy, and otherwise for one of its own when that says so.
+//It is parked instead if its group has had its quota.
+void schedule() {
+  cpu_t* cpu = this_cpu();
+  spin_lock(&proc_lock);
+  if (current->policy == SCHED_EDF && !is_idle(current) 
+      && rt_exhausted(current, cpu, timer_now())) {
+    rt_throttle();
+    spin_unlock(&proc_lock);
+    return;
+  }
+  account(cpu);
+  group_t* g = &groups[current->group];
+  if (g->quota != 0 && !g->throttled && g->runtime >= g->quota 
+      && current->policy != SCHED_EDF) group_throttle(g, timer_now());
+  if (group_holds(current)) {
+    group_park(current);
+    next(STATUS_WAITING);
+    spin_unlock(&proc_lock);
+    return;
+  }
+  pcb_t* new = rq_best(&cpu->runq, false);
+  if (new == NULL && is_idle(current)) new = steal();
+
+  if (!is_idle(current) 
+      && (new == NULL || sched_of(new)->rank >= sched_of(current)->rank)) {
+    sched_ops_t* s = sched_of(current);
+    new = s->pick_next(&cpu->runq);
+    if (!s->tick(cpu, current, new)) new = NULL;
+  }
+  if (new != NULL) {
+    context_switch(current, new, STATUS_READY);
     #if PRINT_SWITCHES
-    char b = '0' + new;
-    PL011_putc    (UART0,  b , true);
-    PL011_putc    (UART0, ':', true);
+    PL011_putc(UART0, '>', true);
   }
-  else  {
-    PL011_putc (UART0, '~', true);
+  else {
+    PL011_putc(UART0, '~', true);
     #endif
   }
+  spin_unlock(&proc_lock);
 }
-#else
-void schedule(ctx_t* ctx) {
-  if (current_runtime >= pcb[current].base_priority) {
-    next(ctx, STATUS_READY);
+
+/////
+////  WAIT QUEUES (cont.)
+///
+
+//Block the current process on wq. When woken it re-issues the system call
+//that blocked it, so that call must not have touched ctx->gpr.
+void block_on(ctx_t* ctx, waitq_t* wq) {
+  spin_lock(&proc_lock);
+  ctx->pc -= 4;
+  wq_add(wq, current);
+  next(STATUS_WAITING);
+  spin_unlock(&proc_lock);
+}
+
+//Make every process waiting on wq ready: each retries, and those that still
+//cannot proceed block again
+void wake_all(waitq_t* wq) {
+  spin_lock(&proc_lock);
+  while (wq->head != NULL) {
+    pcb_t* p = wq->head;
+    wq_remove(p);
+    make_ready(p, STATUS_READY);
   }
-  current_runtime++;
+  spin_unlock(&proc_lock);
 }
-#endif
 
-pid_t new_pcb_entry() {
-  int i = 0;
-  //Get the index of the first unallocated entry
-  while (process_exists(i) && i < PCB_SIZE) i++;
-  
-  if (i != PCB_SIZE) pcballoc |= (1 << i);
+//Claim a free PCB slot (growing the table if need be), returning its index or
+//-1 if there are none. Its generation moves on, giving it a new PID.
+int new_pcb_entry() {
+  int i = -1;
+  spin_lock(&proc_lock);
+  //Find the first zero bit, a word at a time
+  for (int w = 0; w < PCB_MAX / 32; ++w) {
+    if (~pcballoc[w]) {
+      i = 32 * w + __builtin_ctz(~pcballoc[w]);
+      break;
+    }
+  }
+  if (i != -1 && pcb_chunks[i / PCB_CHUNK] == NULL) {
+    pcb_chunks[i / PCB_CHUNK] = malloc(PCB_CHUNK * sizeof(pcb_t));
+    if (pcb_chunks[i / PCB_CHUNK] == NULL) i = -1;
+  }
+  if (i != -1) {
+    pcballoc[i / 32] |= 1 << (i % 32);
+    pcbgen[i]++;
+    nprocs++;
+  }
+  spin_unlock(&proc_lock);
   return i;
 }
 
+void free_pcb_entry(int i) {
+  spin_lock(&proc_lock);
+  pcballoc[i / 32] &= ~(1 << (i % 32));
+  nprocs--;
+  spin_unlock(&proc_lock);
+}
+
+//ASIDs are 8 bits, 0 being the kernel's: slots share them, and vm.c sorts
+//out any clashes
+uint8_t slot_asid(int i) {
+  return i % 255 + 1;
+}
+
+//Thread stack i is [thread_stack_top(i) - THREAD_STACK_LIMIT, its top), and
+//the page below it a guard
+uint32_t thread_stack_top(int i) {
+  return STACK_BOTTOM - PAGE_SIZE - i * (THREAD_STACK_LIMIT + PAGE_SIZE);
+}
+
+//Is va in a stack (else a guard page, if in_stacks)?
+bool in_stack(uint32_t va) {
+  if (va >= STACK_BOTTOM && va < USER_STACK_TOP) return true;
+  if (va >= thread_stack_top(0) || va < thread_stack_top(THREAD_MAX)) 
+    return false;
+  return (thread_stack_top(0) - 1 - va) % (THREAD_STACK_LIMIT + PAGE_SIZE)
+         < THREAD_STACK_LIMIT;
+}
+
+//Is va in any stack or guard page?
+bool in_stacks(uint32_t va) {
+  return va >= thread_stack_top(THREAD_MAX) && va < USER_STACK_TOP;
+}
+
 pcb_t* new_user_proc(uint32_t entry, int priority) {
   int i = new_pcb_entry();
-  if (i == PCB_SIZE) //Can't launch, no available PCB space
+  if (i == -1) //Can't launch, no available PCB space
     return NULL;
+  pcb_t* p = slot_pcb(i);
+
+  memset( p, 0, sizeof( pcb_t ) );
+  p->pid      = slot_pid(i);
+  p->ctx.cpsr = 0x50;
+  p->ctx.pc   = entry;
+  p->cpu      = cpu_id();
+  p->policy   = sched_default;
+  p->tstack   = -1;
+  p->proc     = slab_alloc(&proc_cache);
+  if (p->proc == NULL) {
+    free_pcb_entry(i);
+    return NULL;
+  }
+  memset(p->proc, 0, sizeof(proc_t));
+  p->proc->threads = 1;
+  p->proc->pid     = p->pid;
+  memset(p->proc->fdt, -1, 32 * sizeof(int));
+  p->proc->fdt[0] = 0;
+  p->proc->fdt[1] = 1;
+  p->proc->fdt[2] = 2;
+
+  //Only the top page of the stack, the rest come on demand
+  if (!as_create(&p->proc->as, slot_asid(i)) 
+      || !as_populate(&p->proc->as, USER_STACK_TOP - PAGE_SIZE)) {
+    as_destroy(&p->proc->as);
+    slab_free(&proc_cache, p->proc);
+    free_pcb_entry(i);
+    return NULL;
+  }
+  p->ctx.sp   = USER_STACK_TOP;
 
-  memset( &pcb[i], 0, sizeof( pcb_t ) );     // initialise 0-th PCB = P_1
-  pcb[i].pid      = i; //Use PCB index as PID
-  pcb[i].status   = STATUS_CREATED;
-  pcb[i].ctx.cpsr = 0x50;
-  pcb[i].ctx.pc   = entry;
-  memset(pcb[i].fdt, -1, 32 * sizeof(int));
-  pcb[i].fdt[0] = 0;
-  pcb[i].fdt[1] = 1;
-  pcb[i].fdt[2] = 2;
-
-  pcb[i].stack    = malloc(sizeof(stack_area_t));
-  pcb[i].ctx.sp   = top_of(pcb[i].stack); //stack[i];
-
-  pcb[i].base_priority = priority;
-  //Age should already be set to 0 as per 7 lines ago
+  p->base_priority = priority > PRIORITY_MAX ? PRIORITY_MAX : priority;
+  p->inherited     = -1;
+  p->parent        = -1;
+  group_enter(p, 0);
+  make_ready(p, STATUS_CREATED);
 
-  return &pcb[i];
+  return p;
 }
 
 //////////////////
@@ -253,35 +1162,38 @@ bool do_pipe(int * pipefds) {
   int pindex = 0;
   // 1. Get indexes for process FDs
   int wind_p, rind_p = 0; // wind_p does not need initialising here
-  while (rind_p < 32 && pcb[current].fdt[rind_p] != -1) ++rind_p;
+  while (rind_p < 32 && current->proc->fdt[rind_p] != -1) ++rind_p;
   wind_p = rind_p + 1;
-  while (wind_p < 32 && pcb[current].fdt[wind_p] != -1) ++wind_p;
+  while (wind_p < 32 && current->proc->fdt[wind_p] != -1) ++wind_p;
   if (wind_p >= 32) 
     return false; // One or both of the indexes could not be allocated.
 
   // 2. Get pipe index
-  while (pindex < PCB_SIZE && pipes[pindex]) ++pindex;
-  if(pindex==PCB_SIZE) {
+  while (pindex < PIPE_COUNT && pipes[pindex]) ++pindex;
+  if(pindex==PIPE_COUNT) {
     //All pipes are in use
     return false;
   }
   // 3. Get indexes for global FDs
   int rind_g = 0;
-  while (rind_g < 64 && openft[rind_g] != NULL) ++rind_g;
+  while (rind_g < FT_SIZE && openft[rind_g] != NULL) ++rind_g;
   int wind_g = rind_g + 1;
-  while (wind_g < 64 && openft[wind_g] != NULL) ++wind_g;
-  if (rind_g == 64 || wind_g == 64) {
+  while (wind_g < FT_SIZE && openft[wind_g] != NULL) ++wind_g;
+  if (rind_g >= FT_SIZE || wind_g >= FT_SIZE) {
     return false;
   }
   // 4. Allocate pipe & FDs
   fdte_t *rend, *wend;
-  pipes[pindex] = malloc(sizeof(pipe_t));
-  // k_print_int((int) pipefds);
-  if (pipes[pindex] == NULL) return false;
-  rend = malloc(sizeof(fdte_t));
-  if (rend == NULL) return false;
-  wend = malloc(sizeof(fdte_t));
-  if (wend == NULL) return false;
+  pipe_t* pipe = slab_alloc(&pipe_cache);
+  rend = slab_alloc(&fdte_cache);
+  wend = slab_alloc(&fdte_cache);
+  if (pipe == NULL || rend == NULL || wend == NULL) {
+    slab_free(&pipe_cache, pipe);
+    slab_free(&fdte_cache, rend);
+    slab_free(&fdte_cache, wend);
+    return false;
+  }
+  pipes[pindex] = pipe;
   // k_print_int((int) pipefds);
   // 5. Initialise the above
   pipe_reset(pipes[pindex]);
@@ -298,8 +1210,8 @@ bool do_pipe(int * pipefds) {
   openft[rind_g] = rend;
   openft[wind_g] = wend;
   // k_print_int((int) pipefds);
-  pcb[current].fdt[rind_p] = rind_g;
-  pcb[current].fdt[wind_p] = wind_g;
+  current->proc->fdt[rind_p] = rind_g;
+  current->proc->fdt[wind_p] = wind_g;
   // 7. Return
   pipefds[0] = rind_p;
   pipefds[1] = wind_p;
@@ -311,11 +1223,8 @@ bool do_pipe(int * pipefds) {
 int do_open(char* path, char flags) {
   if (!flags) return -1; //What's the point?
   int i = 0;
-  while (i < 64 && openft[i] != NULL) ++i;
-  if (i == 64) return -1;
-
-  openft[i] = malloc(sizeof(fdte_t));
-  if (openft[i] == NULL) return -1;
+  while (i < FT_SIZE && openft[i] != NULL) ++i;
+  if (i == FT_SIZE) return -1;
 
   char* apath   = abs_path(path);
   bool  success = fs2_isftype(&vol, apath, FS2_FTYPE_FILE);
@@ -323,13 +1232,20 @@ int do_open(char* path, char flags) {
   if (!success && (flags >= 4)) success = fs2_create(&vol, FS2_FTYPE_FILE, apath); 
   if (!success) return -1;
 
+  openft[i] = slab_alloc(&fdte_cache);
+  if (openft[i] == NULL) return -1;
+
   // File exists and can be read, fill FD
   fdte_t* fd = openft[i];
   fd->type = FT_FILE;
   fd->mode = fmode_from_flags(flags);
-  // Copy path into a new mem area
-  char* fdpath = malloc(strlen(apath));
-  if (fdpath == NULL) return -1;
+  // Copy path into a new mem area (paths are at most PATH_SIZE, as wd is)
+  char* fdpath = slab_alloc(&path_cache);
+  if (fdpath == NULL) {
+    slab_free(&fdte_cache, fd);
+    openft[i] = NULL;
+    return -1;
+  }
   strcpy(fdpath, apath);
   fd->id   = (uint32_t) fdpath;
   fd->cursor = 0;
@@ -338,48 +1254,78 @@ int do_open(char* path, char flags) {
   return i;
 }
 
-bool do_close(int fd) {
+//Close descriptor fd of process pr
+bool fd_close(proc_t* pr, int fd) {
   if (fd < 0 || fd >= 32) return false;
-  int i = pcb[current].fdt[fd];
+  int i = pr->fdt[fd];
   if (i == -1) return false; //Nothing to close
   
-  pcb[current].fdt[fd] = -1;
+  pr->fdt[fd] = -1;
   fdte_t* fde = openft[i];
   if(--fde->open_count > 0) return true;
 
   switch (fde->type) {
     case FT_PIPE: {
-      bool close = true;
-      // Close pipe, and its counterpart. Subsequent ops on the pipe will fail
-      free(openft[fde->cursor]); 
+      // Last descriptor for this end: wake the other end's waiters so they
+      // see EOF (readers) or a broken pipe (writers)
+      pipe_t* pipe = pipes[fde->id];
+      if (fde->mode == FM_R) {
+        pipe->rclosed = true;
+        wake_all(&pipe->writers);
+      } else {
+        pipe->wclosed = true;
+        wake_all(&pipe->readers);
+      }
+      // Once both ends are closed, so is the pipe
+      if (pipe->rclosed && pipe->wclosed) {
+        slab_free(&pipe_cache, pipe);
+        pipes[fde->id] = NULL;
+      }
+      slab_free(&fdte_cache, fde);
+      openft[i] = NULL;
+      return true;
     }
     case FT_UART: 
       // Just remove the process's descriptor, don't close the stream
       return true;
     case FT_FILE:
-      free((char*) fde->id);
-      free(fde);
+      slab_free(&path_cache, (char*) fde->id);
+      slab_free(&fdte_cache, fde);
       openft[i] = NULL;
-      pcb[current].fdt[fd] = -1;
       return true;
     default:
       return false;
   }
 }
 
-int do_write(int fd, char* in, int nchars) {
-  int i = pcb[current].fdt[fd];
+bool do_close(int fd) {
+  return fd_close(current->proc, fd);
+}
+
+//Returns WQ_BLOCK if the current process has been blocked, and will retry
+int do_write(ctx_t* ctx, int fd, char* in, int nchars) {
+  int i = current->proc->fdt[fd];
   if (i == -1) return -1; //Nothing to write to
   
   fdte_t* fde = openft[i];
   if (fde==NULL) return -1;
   if (!(fde->mode == FM_W || fde->mode == FM_RW)) return 0;
   switch (fde->type) {
-    case FT_UART:
-      for (int j = 0; j < nchars; ++j) PL011_putc((PL011_t*) fde->id, in[j], true);
-      return nchars;
-    case FT_PIPE:
-      return pipe_write(pipes[fde->id], in, nchars);
+    case FT_UART: {
+      //The buffer is drained from the TX interrupt, under proc_lock
+      spin_lock(&proc_lock);
+      int n = tty_write(&tty0, in, nchars);
+      if (n == WQ_BLOCK) block_on(ctx, &tty0.writers);
+      spin_unlock(&proc_lock);
+      return n;
+    }
+    case FT_PIPE: {
+      pipe_t* pipe = pipes[fde->id];
+      int n = pipe_write(pipe, in, nchars);
+      if      (n == WQ_BLOCK) block_on(ctx, &pipe->writers);
+      else if (n > 0)           wake_all(&pipe->readers);
+      return n;
+    }
     case FT_FILE: {
       int n = fs2_write(&vol, (char*) fde->id, in, nchars, fde->cursor);
       if (n >= 0) fde->cursor += n;
@@ -388,8 +1334,9 @@ int do_write(int fd, char* in, int nchars) {
   }
 }
 
-int do_read(int fd, char* out, int nchars) {
-  int i = pcb[current].fdt[fd];
+//Returns WQ_BLOCK if the current process has been blocked, and will retry
+int do_read(ctx_t* ctx, int fd, char* out, int nchars) {
+  int i = current->proc->fdt[fd];
   if (i == -1) return -1; //Nothing to read from
   
   fdte_t* fde = openft[i];
@@ -397,17 +1344,20 @@ int do_read(int fd, char* out, int nchars) {
   if (!(fde->mode == FM_R || fde->mode == FM_RW)) return 0;
   switch (fde->type) {
     case FT_UART: {//UART reads will be treated as readline calls
-      int j;
-      for (j = 0; j < nchars; ++j) {
-        out[j] = PL011_getc((PL011_t*) fde->id, true);
-        if (out[j] = '\x0A') {
-          out[j] = '\0'; break;
-        }
-      }
-      return j;
+      //The buffer is filled from the RX interrupt, under proc_lock
+      spin_lock(&proc_lock);
+      int n = tty_read(&tty0, out, nchars);
+      if (n == WQ_BLOCK) block_on(ctx, &tty0.readers);
+      spin_unlock(&proc_lock);
+      return n;
+    }
+    case FT_PIPE: {
+      pipe_t* pipe = pipes[fde->id];
+      int n = pipe_read(pipe, out, nchars);
+      if      (n == WQ_BLOCK) block_on(ctx, &pipe->readers);
+      else if (n > 0)           wake_all(&pipe->writers);
+      return n;
     }
-    case FT_PIPE:
-      return pipe_read(pipes[fde->id], out, nchars);
     case FT_FILE: {
       int n = fs2_read(&vol, (char*) fde->id, out, nchars, fde->cursor);
       if (n >= 0) fde->cursor += n;
@@ -416,10 +1366,28 @@ int do_read(int fd, char* out, int nchars) {
   }
 }
 
+void wake_sleeper(tmr_t* t) {
+  make_ready((pcb_t*) t->data, STATUS_READY);
+}
+
+//Block the current process for (at least) us microseconds
+void do_sleep(uint32_t us) {
+  if (us == 0) {
+    next(STATUS_READY);
+    return;
+  }
+  spin_lock(&proc_lock);
+  current->sleep_timer.fire = &wake_sleeper;
+  current->sleep_timer.data = current;
+  timer_add(&current->sleep_timer, us);
+  next(STATUS_SLEEPING);
+  spin_unlock(&proc_lock);
+}
+
 bool do_cd(char* cd) {
   char* apath = abs_path(cd);
   if (!fs2_isftype(&vol, apath, FS2_FTYPE_DIR)) return false;
-  strcpy(pcb[current].wd, apath);
+  strcpy(current->proc->wd, apath);
   return true;
 }
 
@@ -430,31 +1398,107 @@ void halt() {
   while (1);
 }
 
-void do_exit() {
-  #if PRINT_SWITCHES
-    PL011_putc(UART0, '*', true);
-  #endif
-  pcb[current].status = STATUS_TERMINATED;
-  pcb[current].base_priority = -1;
-  free(pcb[current].stack);
-  for(int i = 0; i < 32; ++i) {
-    if (pcb[current].fdt[i] != -1) do_close(i);
+//Release everything p holds in the process table, but for its PCB if it is
+//the first thread of a process that is still running, or whose parent has
+//yet to wait for it. p must not be executing, unless it is the
+//current process and is about to be switched away from with proc_lock still
+//held (else its PCB could be reused, or reaped, under it).
+void terminate(pcb_t* p) {
+  //Its files may need closing, and come first in the lock order
+  spin_lock(&file_lock);
+  spin_lock(&proc_lock);
+  rq_dequeue(p);
+  wq_remove(p);
+  //A mutex's owner may have been lent priority by p, which is no longer waiting
+  if (p->sem_on != NULL && p->sem_on->mutex) {
+    pcb_t* o = pcb_of(p->sem_on->owner);
+    if (o != NULL) reinherit(o);
+  }
+  p->sem_on = NULL;
+  //Its mutexes stay locked, but are no longer anyone's to pass priority to
+  for (sem_t* m = p->held; m != NULL; m = m->held_next) m->owner = -1;
+  p->held = NULL;
+  timer_del(&p->sleep_timer);
+  p->status = STATUS_TERMINATED;
+  p->base_priority = -1;
+  if (p->policy == SCHED_EDF) {
+    rt_leave(p);
+    p->policy = sched_default;
+  }
+  group_leave(p);
+  proc_t* pr   = p->proc;
+  pcb_t*  m    = proc_pcb(pr);
+  bool    last = --pr->threads == 0;
+  pr->cputime += p->cputime;
+  if (last) {
+    //The last thread out, however it went, closes the process's files
+    for (int i = 0; i < 32; ++i) {
+      if (pr->fdt[i] != -1) fd_close(pr, i);
+    }
+    //Its tables are about to be freed, so must not be left loaded
+    if (p == current) as_switch(&kernel_as);
+    as_destroy(&pr->as);
+    m->cputime = pr->cputime;
+    slab_free(&proc_cache, pr);
+  }
+  else if (p->tstack >= 0) {
+    //The other threads carry on: just give up its stack
+    as_unmap(&pr->as, thread_stack_top(p->tstack) - THREAD_STACK_LIMIT,
+                      thread_stack_top(p->tstack));
+    pr->stacks &= ~(1 << p->tstack);
+  }
+  //Anyone joining it can stop waiting
+  wake_all(&p->exitq);
+  if (p->vfp != NULL) {
+    slab_free(&vfp_cache, p->vfp);
+    p->vfp = NULL;
+  }
+  p->proc = NULL;
+  //Other threads than the first are done with. The first is kept, for as
+  //long as the process runs, to stand for it.
+  if (p != m) free_pcb_entry(pid_slot(p->pid));
+  if (last) {
+    //Nobody is left to wait for its children: those already finished go
+    //now, the rest as soon as they do
+    pcb_t* next;
+    for (pcb_t* c = m->first_child; c != NULL; c = next) {
+      next = c->next_sibling;
+      c->parent       = -1;
+      c->next_sibling = NULL;
+      if (c->zombie) free_pcb_entry(pid_slot(c->pid));
+    }
+    m->first_child = NULL;
+    //It is kept, as a zombie, until its parent waits for it
+    pcb_t* parent = proc_of(m->parent);
+    if (parent != NULL) {
+      m->zombie = true;
+      wake_all(&parent->childq);
+    }
+    else free_pcb_entry(pid_slot(m->pid));
   }
-  //Age will be 0 as has been executing
-  pcballoc -= (1 << current);
   /////////////////////////////////////////////////////////
   // IF ALL PROCESSES TERMINATED KERNEL SHOULD HALT HERE //
   /////////////////////////////////////////////////////////
-  if(!pcballoc) halt();
+  if(!nprocs) halt();
+  spin_unlock(&proc_lock);
+  spin_unlock(&file_lock);
+}
+
+//End the current thread with the given exit status. Call with proc_lock
+//held, and switch away before releasing it
+void do_exit(int status) {
+  #if PRINT_SWITCHES
+    PL011_putc(UART0, '*', true);
+  #endif
+  current->exit_status = status;
+  terminate(current);
 }
 
 //Create a new process identical to the current, differentiating between parent
 //and child
 void do_fork(ctx_t* ctx) {
-  //Preserve context
-  memcpy(&pcb[current].ctx, ctx, sizeof(ctx_t));
-  pid_t child_pid = new_pcb_entry();
-  if (child_pid == PCB_SIZE) {
+  int slot = new_pcb_entry();
+  if (slot == -1) {
     //PCB table is full
     PL011_putc(UART0, '!', true);
     ctx->gpr[0] = -1;
@@ -463,142 +1507,661 @@ void do_fork(ctx_t* ctx) {
   #if PRINT_SWITCHES
     PL011_putc(UART0, 'f', true);
   #endif
+  pcb_t* child = slot_pcb(slot);
   //Init child, with same priority as parent
-  memcpy(& pcb [child_pid], & pcb [current], sizeof(pcb_t));
-
-  stack_area_t* child_stack = malloc(sizeof(stack_area_t));
-  if (child_stack == NULL) {
-    //Could not allocate memory for the child process's stack
+  memcpy(child, current, sizeof(pcb_t));
+  //Only the calling thread is copied, into a process of its own
+  child->proc = slab_alloc(&proc_cache);
+  if (child->proc == NULL) {
     PL011_putc(UART0, 'M', true);
+    free_pcb_entry(slot);
     ctx->gpr[0] = -2;
     return;
   }
-  memcpy(child_stack, pcb[current].stack, sizeof(stack_area_t));
-
-  pcb[child_pid].pid    = child_pid;
-  pcb[child_pid].status = STATUS_CREATED;
+  memcpy(child->proc, current->proc, sizeof(proc_t));
+  child->proc->threads = 1;
+  child->proc->pid     = slot_pid(slot);
+  child->proc->cputime = 0;
+  child->proc->stacks  = current->tstack >= 0 ? 1 << current->tstack : 0;
+  child->exitq.head = child->exitq.tail = NULL;
+
+  //The child's memory is a copy of the parent's, at the same addresses, so
+  //its stack pointer (and any pointer into its stack) carries over as is.
+  //Pages are only actually copied when one side writes to them.
+  if (!as_fork(&child->proc->as, &current->proc->as, slot_asid(slot))) {
+    //Could not allocate memory for the child process's pages
+    PL011_putc(UART0, 'M', true);
+    slab_free(&proc_cache, child->proc);
+    free_pcb_entry(slot);
+    ctx->gpr[0] = -2;
+    return;
+  }
+  //But for the other threads' stacks: their slots are free in the child,
+  //and a thread started in one must not find the old pages there
+  uint32_t others = current->proc->stacks & ~child->proc->stacks;
+  for (; others != 0; others &= others - 1) {
+    int t = __builtin_ctz(others);
+    as_unmap(&child->proc->as, thread_stack_top(t) - THREAD_STACK_LIMIT,
+                               thread_stack_top(t));
+  }
 
-  // Correct stack pointer: without the below casts the subtraction returns an
-  // incorrect value
-  uint32_t s_cur = (uint32_t) pcb[current].stack;
-  uint32_t s_cld = (uint32_t) child_stack;
-  pcb[child_pid].ctx.sp += (s_cld - s_cur);
+  //As are its VFP/NEON registers, as of now
+  if (current->vfp != NULL) {
+    if (vfp_enabled()) vfp_save(current->vfp);
+    child->vfp = slab_alloc(&vfp_cache);
+    if (child->vfp == NULL) {
+      PL011_putc(UART0, 'M', true);
+      as_destroy(&child->proc->as);
+      slab_free(&proc_cache, child->proc);
+      free_pcb_entry(slot);
+      ctx->gpr[0] = -2;
+      return;
+    }
+    memcpy(child->vfp, current->vfp, sizeof(vfp_t));
+    child->vfp_cpu = -1;
+  }
 
-  pcb[child_pid].stack   = child_stack;
+  child->pid    = slot_pid(slot);
+  //Holds none of the parent's mutexes
+  child->inherited = -1;
+  child->held      = NULL;
+  //Nor its real-time reservation
+  if (child->policy == SCHED_EDF) set_policy(child, sched_default);
+  //Nor its children or CPU time, and it is a child of the whole process
+  child->killed       = false;
+  child->cputime      = 0;
+  pcb_t* parent       = proc_pcb(current->proc);
+  child->parent       = parent->pid;
+  child->first_child  = NULL;
+  child->childq.head  = child->childq.tail = NULL;
+  child->zombie       = false;
+  child->exit_status  = EXIT_KILLED;
+  //Its parent's list is also changed by waits and exits on other cores
+  spin_lock(&proc_lock);
+  child->next_sibling = parent->first_child;
+  parent->first_child = child;
+  spin_unlock(&proc_lock);
+  //But is in its group
+  group_enter(child, current->group);
 
   // Differentiate processes
-  pcb[child_pid].ctx.gpr[0] = 0;
-  ctx->gpr[0] = child_pid;
+  child->ctx.gpr[0] = 0;
+  ctx->gpr[0] = child->pid;
 
   // Update file descriptors
   for(int i = 0; i < 32; ++i) {
-    if (pcb[current].fdt[i] != -1) openft[pcb[current].fdt[i]]->open_count++;
+    if (current->proc->fdt[i] != -1) openft[current->proc->fdt[i]]->open_count++;
+  }
+
+  make_ready(child, STATUS_CREATED);
+}
+
+//Start a thread of the current process at entry(arg), returning to ret: it
+//shares the process's memory and files, but has a stack of its own. Returns
+//its ID, or -1 if there is no room for it.
+pid_t do_thread(uint32_t entry, uint32_t arg, uint32_t ret) {
+  spin_lock(&proc_lock);
+  proc_t* pr = current->proc;
+  int t    = __builtin_ffs(~pr->stacks) - 1;
+  int slot = t < 0 || t >= THREAD_MAX ? -1 : new_pcb_entry();
+  if (slot == -1) {
+    spin_unlock(&proc_lock);
+    return -1;
   }
+  pcb_t* p = slot_pcb(slot);
+  memset(p, 0, sizeof(pcb_t));
+  p->pid           = slot_pid(slot);
+  p->base_priority = current->base_priority;
+  p->inherited     = -1;
+  p->parent        = -1;
+  p->cpu           = cpu_id();
+  p->policy        = current->policy == SCHED_EDF ? sched_default 
+                                                    : current->policy;
+  p->proc          = pr;
+  p->tstack        = t;
+  p->ctx.cpsr      = 0x50;
+  p->ctx.pc        = entry;
+  p->ctx.gpr[0]    = arg;
+  p->ctx.lr        = ret;
+  //Its pages come on demand
+  p->ctx.sp        = thread_stack_top(t);
+  pr->stacks |= 1 << t;
+  pr->threads++;
+  group_enter(p, current->group);
+  make_ready(p, STATUS_CREATED);
+  spin_unlock(&proc_lock);
+  return p->pid;
+}
+
+//Wait for thread tid of the current process to finish. Returns true once it
+//has (or if it already had), false if it is not one of ours, or WQ_BLOCK
+//having blocked the caller until then.
+int do_join(ctx_t* ctx, pid_t tid) {
+  spin_lock(&proc_lock);
+  pcb_t* t = pcb_of(tid);
+  int r = t == NULL ? true
+        : t == current || t->proc != current->proc ? false
+        : WQ_BLOCK;
+  if (r == WQ_BLOCK) block_on(ctx, &t->exitq);
+  spin_unlock(&proc_lock);
+  return r;
 }
 
 void do_exec(ctx_t* ctx) {
   uint32_t entry = ctx->gpr[0];
   ctx->pc   = entry;
-  ctx->sp   = top_of(pcb[current].stack);
+  ctx->sp   = USER_STACK_TOP;
   ctx->cpsr = 0x50;
+  //No argument (EXECX then supplies one)
+  ctx->gpr[0] = 0;
+  //The new program starts with clean VFP/NEON registers, if it uses them
+  if (current->vfp != NULL) {
+    slab_free(&vfp_cache, current->vfp);
+    current->vfp = NULL;
+  }
+  vfp_unable();
+}
+
+//Reap child pid of the current process (any child, if pid is -1) once it
+//has finished, copying out its exit status and the CPU time it had to
+//status and cputime (unless NULL). Returns its PID, -1 if there is no such
+//child, or, while it has yet to finish, 0 if nohang, else WQ_BLOCK having
+//blocked the caller until one does.
+int do_waitpid(ctx_t* ctx, pid_t pid, int* status, uint32_t* cputime, 
+               bool nohang) {
+  spin_lock(&proc_lock);
+  //Children are the whole process's, any of whose threads may wait for them
+  pcb_t* me = proc_pcb(current->proc);
+  int r = -1;
+  for (pcb_t** l = &me->first_child; *l != NULL; l = &(*l)->next_sibling) {
+    pcb_t* c = *l;
+    if (pid != -1 && c->pid != pid) continue;
+    if (!c->zombie) {
+      r = nohang ? 0 : WQ_BLOCK;
+      continue;
+    }
+    r = c->pid;
+    if (status  != NULL) *status  = c->exit_status;
+    if (cputime != NULL) *cputime = (uint32_t) c->cputime;
+    *l = c->next_sibling;
+    free_pcb_entry(pid_slot(c->pid));
+    break;
+  }
+  if (r == WQ_BLOCK) block_on(ctx, &me->childq);
+  spin_unlock(&proc_lock);
+  return r;
+}
+
+//The CPU time process pid has had, in µs (mod 2^32), or -1 if there is no
+//such process
+uint32_t do_cputime(pid_t pid) {
+  spin_lock(&proc_lock);
+  pcb_t*   p = pcb_of(pid);
+  //Bring it up to date, if it is the one running here
+  if (p == current) account(this_cpu());
+  uint32_t t = p == NULL ? -1 : (uint32_t) p->cputime;
+  spin_unlock(&proc_lock);
+  return t;
+}
+
+//Switch process pid (or, if pid is -1, every process, and the default for
+//new ones) to policy pol, unless pol is -1. Returns the policy it was on, or
+//-1 if there is no such process or policy.
+//Real-time processes need a reservation (see do_rt) to be switched to, so
+//are left as they are by a switch of every process.
+int do_sched(pid_t pid, int pol) {
+  if (pol < -1 || pol >= SCHED_POLICIES || pol == SCHED_EDF) return -1;
+  int old = -1;
+  spin_lock(&proc_lock);
+  if (pid == -1) {
+    old = sched_default;
+    if (pol != -1) {
+      sched_default = pol;
+      //Only the slots in use, found a word of the bitmap at a time, rather
+      //than every slot with proc_lock held
+      for (int w = 0; w < PCB_MAX / 32; ++w) {
+        for (uint32_t used = pcballoc[w]; used != 0; used &= used - 1) {
+          pcb_t* p = slot_pcb(32 * w + __builtin_ctz(used));
+          //Zombies, and first threads kept for their processes, have no
+          //policy left to change
+          if (p->proc != NULL && p->policy != SCHED_EDF) set_policy(p, pol);
+        }
+      }
+    }
+  }
+  else {
+    pcb_t* p = pcb_of(pid);
+    if (p != NULL) {
+      old = p->policy;
+      if (pol != -1) {
+        bool throttled = old == SCHED_EDF && rt_leave(p);
+        set_policy(p, pol);
+        if (throttled) make_ready(p, STATUS_READY);
+      }
+    }
+  }
+  spin_unlock(&proc_lock);
+  return old;
+}
+
+//Make the current process real-time, released every period µs to run for
+//up to budget µs, due deadline µs (if 0, period) after each release; or, for
+//a period of 0, return it to the default policy. Sets the result in ctx:
+//false, leaving it as it was, if the reservation fits on no core.
+void do_rt(ctx_t* ctx, uint32_t period, uint32_t budget, uint32_t deadline) {
+  pcb_t* p = current;
+  if (deadline == 0) deadline = period;
+  ctx->gpr[0] = false;
+  if (period != 0 && (budget == 0 || budget > deadline || deadline > period))
+    return;
+  spin_lock(&proc_lock);
+  bool was = p->policy == SCHED_EDF;
+  if (period == 0) {
+    if (was) {
+      rt_leave(p);
+      set_policy(p, sched_default);
+    }
+    ctx->gpr[0] = true;
+    spin_unlock(&proc_lock);
+    return;
+  }
+
+  //This core if it has room, else whichever has most. Its own reservation,
+  //if it has one, is about to make way
+  uint32_t need = rt_density(budget, deadline);
+  uint32_t own  = was ? rt_density(p->rt.budget, p->rt.deadline) : 0;
+  int      c    = -1;
+  uint32_t room = 0;
+  for (int i = 0; i < NCPU; ++i) {
+    if (!((online_mask >> i) & 1)) continue;
+    uint32_t r = EDF_DENSITY_MAX + (i == p->cpu ? own : 0) - cpus[i].rt_density;
+    if (r < need) continue;
+    if (c == -1 || r > room || i == cpu_id()) {
+      c    = i;
+      room = i == cpu_id() ? -1 : r;
+    }
+  }
+  if (c == -1 || (!was && rt_count == EDF_MAX)) {
+    spin_unlock(&proc_lock);
+    return;
+  }
+
+  if (was) rt_leave(p);
+  rt_procs[rt_count++] = p;
+  cpus[c].rt_density += need;
+  uint32_t now = timer_now();
+  p->rt = (rt_t) { period, budget, deadline, now, now + deadline, 0, false };
+  //It has been charged up to exec_start, and only from now counts
+  p->rt.used = -(now - this_cpu()->exec_start);
+  set_policy(p, SCHED_EDF);
+  ctx->gpr[0] = true;
+  if (c != cpu_id()) {
+    //Hand it over to its new core
+    next(STATUS_SLEEPING);
+    p->cpu = c;
+    make_ready(p, STATUS_READY);
+  }
+  rt_arm();
+  spin_unlock(&proc_lock);
+}
+
+//g's period is over: let its members go, unless they ran so far over their
+//quota that the new one is used up already
+void group_release(tmr_t* t) {
+  group_t* g   = t->data;
+  uint32_t now = timer_now();
+  spin_lock(&proc_lock);
+  group_advance(g, now);
+  if (g->runtime >= g->quota) timer_add(t, g->start + g->period - now);
+  else {
+    g->throttled       = false;
+    g->throttled_time += now - g->throttled_at;
+    wake_all(&g->parked);
+  }
+  spin_unlock(&proc_lock);
+}
+
+//Create a bandwidth group whose members get quota µs of CPU time between
+//them (across every core) per period µs, or as much as they like for a quota
+//of 0. Returns its ID, or -1 if there is no room or the quota is impossible.
+int do_group_create(uint32_t quota, uint32_t period) {
+  if (quota != 0 
+      && (period < GROUP_PERIOD_MIN || quota > (uint64_t) period * NCPU))
+    return -1;
+  spin_lock(&proc_lock);
+  int i = 1;
+  while (i < GROUP_MAX && groups[i].used) ++i;
+  if (i < GROUP_MAX) {
+    group_t* g = &groups[i];
+    memset(g, 0, sizeof(group_t));
+    g->used       = true;
+    g->quota      = quota;
+    g->period     = period;
+    g->start      = timer_now();
+    g->timer.fire = &group_release;
+    g->timer.data = g;
+  }
+  spin_unlock(&proc_lock);
+  return i < GROUP_MAX ? i : -1;
+}
+
+//Move process pid (the caller if -1), and every other thread of it, into
+//group gid. Returns false if there is no such process or group.
+bool do_group_join(pid_t pid, int gid) {
+  spin_lock(&proc_lock);
+  pcb_t* t  = pid == -1 ? current : pcb_of(pid);
+  bool   ok = t != NULL && gid >= 0 && gid < GROUP_MAX && groups[gid].used;
+  //Its threads are all in the same group, so only that group's members need
+  //looking through. Those moved go on the head of gid's list, so are not met
+  //again if it is the same group.
+  pcb_t* next;
+  for (pcb_t* p = ok ? groups[t->group].first : NULL; p != NULL; p = next) {
+    next = p->group_next;
+    if (p->proc != t->proc) continue;
+    bool   parked = p->wq == &groups[p->group].parked;
+    runq_t* rq    = p->rq;
+    rq_dequeue(p);
+    if (parked) wq_remove(p);
+    group_leave(p);
+    group_enter(p, gid);
+    //Queued again, or parked if the new group is throttled too. One that is
+    //running is caught by its next tick.
+    if      (parked)     make_ready(p, STATUS_READY);
+    else if (rq != NULL) rq_enqueue(rq, p);
+  }
+  spin_unlock(&proc_lock);
+  return ok;
+}
+
+//Copy group gid's quota, members and totals out to stat
+bool do_group_stat(int gid, group_stat_t* stat) {
+  if (gid < 0 || gid >= GROUP_MAX || !groups[gid].used) return false;
+  spin_lock(&proc_lock);
+  group_t* g   = &groups[gid];
+  uint32_t now = timer_now();
+  //Bring it up to date, if one of its members is running here
+  account(this_cpu());
+  stat->quota          = g->quota;
+  stat->period         = g->period;
+  stat->members        = g->members;
+  stat->usage          = g->usage;
+  stat->throttled_time = g->throttled_time 
+                       + (g->throttled ? now - g->throttled_at : 0);
+  stat->throttles      = g->throttles;
+  spin_unlock(&proc_lock);
+  return true;
+}
+
+//Free group gid, which must have no members left. Group 0 cannot be.
+bool do_group_destroy(int gid) {
+  if (gid <= 0 || gid >= GROUP_MAX) return false;
+  spin_lock(&proc_lock);
+  group_t* g  = &groups[gid];
+  bool     ok = g->used && g->members == 0;
+  if (ok) {
+    timer_del(&g->timer);
+    g->used = false;
+  }
+  spin_unlock(&proc_lock);
+  return ok;
 }
 
 void do_kill(pid_t pid) {
-  if (pid < 0 || pid >= PCB_SIZE) return;
-  if (process_exists(pid)) {
+  spin_lock(&proc_lock);
+  pcb_t* p = pcb_of(pid);
+  if (p != NULL && !p->killed) {
     #if PRINT_SWITCHES
       PL011_putc(UART0, 'k', true);
     #endif
-    pcballoc -= (1 << pid);
-    free(pcb[pid].stack);
+    if (p == current) {
+      //A process killing itself must not be resumed
+      terminate(current);
+      next(STATUS_TERMINATED);
+    }
+    else if (p->status == STATUS_EXECUTING) {
+      //Executing on another core, which has to switch away from it before
+      //it can be released
+      p->killed = true;
+      sgi_send(1 << p->cpu, SGI_RESCHED);
+    }
+    else terminate(p);
   } 
+  spin_unlock(&proc_lock);
+}
+
+//The semaphore with the given ID, or NULL if there is none
+sem_t* sem_of(sem_id_t sem_id) {
+  if (sem_id < SEM_COUNT) return &sem[sem_id];
+  sem_t* s = named_sems[(sem_id - SEM_COUNT) & (SEM_NAMED_MAX - 1)];
+  return s != NULL && s->id == sem_id ? s : NULL;
+}
 
-  if(!pcballoc) halt();
+sem_t** sem_bucket(char* name) {
+  uint32_t h = 5381;
+  while (*name) h = h * 33 + (uint8_t) *name++;
+  return &sem_hash[h % SEM_HASH_SIZE];
+}
+
+sem_t* sem_named(char* name) {
+  for (sem_t* s = *sem_bucket(name); s != NULL; s = s->hnext)
+    if (strcmp(s->name, name) == 0) return s;
+  return NULL;
+}
+
+//Hand the semaphore to waiters from the head of its queue for as long as it
+//can satisfy them. Each is woken with its wait already complete.
+void sem_wake(sem_t* s) {
+  spin_lock(&proc_lock);
+  while (s->wq.head != NULL && s->wq.head->sem_need <= s->value) {
+    pcb_t* p = s->wq.head;
+    s->value -= p->sem_need;
+    wq_remove(p);
+    p->sem_on = NULL;
+    if (s->mutex && s->owner == -1) mutex_acquired(s, p);
+    make_ready(p, STATUS_READY);
+    s->wakeups++;
+    #if PRINT_SEM_OPS
+      PL011_putc(UART0, '(', true);
+      PL011_putc(UART0, 'w', true);
+      PL011_putc(UART0, '0' + pid_slot(p->pid), true);
+      PL011_putc(UART0, ')', true);
+    #endif
+  }
+  spin_unlock(&proc_lock);
 }
 
-//Check for any process P that is waiting and eligible for the semaphore given
-//by sem_id, if P exists increment the sem value by x-y (where y is the amount
-//P was waiting for) and set P to active. Otherwise, increment sem value by x.
-//A potential flaw with this system may manifest when >1 processes are waiting
-//for different quantities of the semaphore. The process waiting for the
-//higher value may starve if another process or processes loop(s), posting and
-//waiting for the same, lower value.
+//Increment the semaphore given by sem_id by x, and wake whichever waiters at
+//the head of its queue that now satisfies
 void do_sem_post(sem_id_t sem_id, uint32_t x) {
   //Return if id out of range, or x is 0 (no effect)
-  if (sem_id < 0 || sem_id >= PCB_SIZE || !x) return; 
+  sem_t* s = sem_of(sem_id);
+  if (s == NULL || !x) return; 
   #if PRINT_SEM_OPS
     PL011_putc(UART0, '[', true);
     PL011_putc(UART0, 'p', true);
     PL011_putc(UART0, '0' + sem_id, true);
     PL011_putc(UART0, '=', true);
   #endif
-  for ( int i = (current + 1) % PCB_SIZE;
-        i != current;
-        i = (i + 1) % PCB_SIZE ) {
-    if (process_exists(i)
-        && pcb[i].status == STATUS_WAITING
-        && pcb[i].waiting->sem_id == sem_id
-        && pcb[i].waiting->x      <= x     ) {
-          //Process i is waiting and eligible for this semaphore
-          sem[sem_id] += (x - pcb[i].waiting->x); //Increase sem by x-y
-          pcb[i].status = STATUS_READY; //Set process i to active
-          free(pcb[i].waiting); //Deallocate the wait values
-          // pcb[i].waiting = NULL; //Not required
-          #if PRINT_SEM_OPS
-            PL011_putc(UART0, '(', true);
-            PL011_putc(UART0, 'w', true);
-            PL011_putc(UART0, '0' + i, true);
-            PL011_putc(UART0, ')', true);
-            PL011_putc(UART0, '0' + sem[sem_id], true);
-            PL011_putc(UART0, ']', true);
-          #endif
-          return;
-        }
-  }
-  //If this statement is reached, no process was waiting and eligible for sem,
-  //so simply increase it.
-  sem[sem_id] += x;
+  //Only its owner's post gives up a mutex, and what it inherited through it
+  if (s->mutex && s->owner == current->pid) mutex_released(s);
+  s->value += x;
+  sem_wake(s);
   #if PRINT_SEM_OPS
-    PL011_putc(UART0, '0' + sem[sem_id], true);
+    PL011_putc(UART0, '0' + s->value, true);
     PL011_putc(UART0, ']', true);
   #endif
 }
 
-//If the semaphore indicated by sem_id has ≥x units, decrement it and return
-//control to the current process. If not, set the current process to WAITING
-//and yield control.
-bool do_sem_wait(sem_id_t sem_id, uint32_t x) {
-  if (sem_id < 0 || sem_id >= PCB_SIZE) { 
-    //Unsure what to do in this case: probably terminate the process
-    k_print("\nProcess 0x");
-    if (current > 15) PL011_putc(UART0, '1', true);
-    PL011_puth(UART0, current, true);
-    k_print(" attempted to wait for invalid semaphore - terminating.\n");
-    do_exit();
-  }
+//If the semaphore indicated by sem_id has ≥x units, and nobody is queued
+//ahead, decrement it and return true. If not, queue the current process on it
+//and return WQ_BLOCK: the caller then switches away, and the process resumes
+//once a post has handed it x units. Returns false if there is no such
+//semaphore.
+int do_sem_wait(sem_id_t sem_id, uint32_t x) {
+  sem_t* s = sem_of(sem_id);
+  if (s == NULL) return false;
   #if PRINT_SEM_OPS
     PL011_putc(UART0, '[', true);
     PL011_putc(UART0, 'w', true);
     PL011_putc(UART0, '0' + sem_id, true);
     PL011_putc(UART0, '=', true);
   #endif
-  if (sem[sem_id] >= x) {
-    sem[sem_id] -= x;
+  s->waits++;
+  if (s->wq.head == NULL && s->value >= x) {
+    s->value -= x;
+    if (s->mutex && s->owner == -1) mutex_acquired(s, current);
     #if PRINT_SEM_OPS
-      PL011_putc(UART0, '0' + sem[sem_id], true);
+      PL011_putc(UART0, '0' + s->value, true);
       PL011_putc(UART0, ']', true);
     #endif
     return true;
   }
-  pcb[current].status  = STATUS_WAITING;
-  pcb[current].waiting = malloc(sizeof(semwait_t));
-  pcb[current].waiting->sem_id = sem_id;
-  pcb[current].waiting->x = x;
+  s->blocked++;
+  current->sem_on   = s;
+  current->sem_need = x;
+  wq_add(&s->wq, current);
+  inherit(s, priority(current));
   #if PRINT_SEM_OPS
     PL011_putc(UART0, 'W', true);
     PL011_putc(UART0, ']', true);
   #endif
-  return false;
+  return WQ_BLOCK;
+}
+
+//Copy the semaphore's value and counters out to stat
+bool do_sem_stat(sem_id_t sem_id, sem_stat_t* stat) {
+  sem_t* s = sem_of(sem_id);
+  if (s == NULL) return false;
+  spin_lock(&proc_lock);
+  stat->waiters = 0;
+  for (pcb_t* p = s->wq.head; p != NULL; p = p->rq_next) stat->waiters++;
+  spin_unlock(&proc_lock);
+  stat->value   = s->value;
+  stat->waits   = s->waits;
+  stat->blocked = s->blocked;
+  stat->wakeups = s->wakeups;
+  return true;
+}
+
+//Create a semaphore with the given name and initial value, returning its ID,
+//or SEM_NONE if the name is taken (or too long) or there is no room
+sem_id_t do_sem_create(char* name, uint32_t init) {
+  if (strnlen(name, SEM_NAME_SIZE) == SEM_NAME_SIZE || sem_named(name) != NULL)
+    return SEM_NONE;
+  int i = 0;
+  while (i < SEM_NAMED_MAX && named_sems[i] != NULL) ++i;
+  if (i == SEM_NAMED_MAX) return SEM_NONE;
+  sem_t* s = slab_alloc(&sem_cache);
+  if (s == NULL) return SEM_NONE;
+  memset(s, 0, sizeof(sem_t));
+  strcpy(s->name, name);
+  s->value = init;
+  s->mutex = init == 1;
+  s->owner = -1;
+  s->refs  = 1;
+  s->id    = SEM_COUNT + (((++named_gen[i] & 0xFFFFF) << SEM_SLOT_BITS) | i);
+  sem_t** b = sem_bucket(name);
+  s->hnext  = *b;
+  *b        = s;
+  named_sems[i] = s;
+  return s->id;
+}
+
+//The ID of the semaphore with the given name, taking a reference to it, or
+//SEM_NONE if there is none
+sem_id_t do_sem_lookup(char* name) {
+  sem_t* s = sem_named(name);
+  if (s == NULL) return SEM_NONE;
+  s->refs++;
+  return s->id;
+}
+
+//Drop a reference to a named semaphore, freeing it (and its name) with the
+//last. Anyone still waiting on it then is woken with their wait failed.
+bool do_sem_destroy(sem_id_t sem_id) {
+  sem_t* s = sem_of(sem_id);
+  if (s == NULL || sem_id < SEM_COUNT) return false;
+  if (--s->refs > 0) return true;
+  sem_t** b = sem_bucket(s->name);
+  while (*b != s) b = &(*b)->hnext;
+  *b = s->hnext;
+  named_sems[(sem_id - SEM_COUNT) & (SEM_NAMED_MAX - 1)] = NULL;
+  if (s->mutex) mutex_released(s);
+  spin_lock(&proc_lock);
+  while (s->wq.head != NULL) {
+    pcb_t* p = s->wq.head;
+    wq_remove(p);
+    p->sem_on = NULL;
+    p->ctx.gpr[0] = false;
+    make_ready(p, STATUS_READY);
+  }
+  spin_unlock(&proc_lock);
+  slab_free(&sem_cache, s);
+  return true;
+}
+
+/////
+////  FUTEXES
+///
+// User-space locks only enter the kernel to sleep when contended and to wake
+// sleepers. A futex is just the address of a user word: one in the process's
+// own memory is private to it (and whatever shares its address space), one
+// outside (e.g. a global) is shared by every process.
+
+bool futex_private(uint32_t addr) {
+  return addr >= USER_BASE && addr < USER_TOP;
+}
+
+waitq_t* futex_queue(uint32_t addr) {
+  return &futexq[(addr >> 2) % FUTEX_BUCKETS];
+}
+
+//Is addr an aligned word the kernel can read without faulting (or reading a
+//device register)?
+bool futex_valid(uint32_t addr) {
+  if (addr & 3) return false;
+  if (futex_private(addr)) return in_stack(addr);
+  return addr >= RAM_BASE && addr < RAM_TOP;
+}
+
+//Block the current process on the futex at addr, iff it still holds val:
+//checked under the same locks as a wake, so a wake cannot be missed between
+//the caller seeing the word contended and going to sleep. Returns 0 once
+//woken, or -1 at once if the word has changed (or is no futex)
+int do_futex_wait(ctx_t* ctx, uint32_t addr, uint32_t val) {
+  if (!futex_valid(addr)) return -1;
+  spin_lock(&proc_lock);
+  if (*(volatile uint32_t*) addr != val) {
+    spin_unlock(&proc_lock);
+    return -1;
+  }
+  current->futex_addr = addr;
+  ctx->gpr[0] = 0;
+  wq_add(futex_queue(addr), current);
+  next(STATUS_WAITING);
+  spin_unlock(&proc_lock);
+  return WQ_BLOCK;
+}
+
+//Wake up to n processes waiting on the futex at addr, oldest first. Returns
+//how many were woken.
+int do_futex_wake(uint32_t addr, int n) {
+  if (!futex_valid(addr)) return -1;
+  int woken = 0;
+  spin_lock(&proc_lock);
+  pcb_t* p = futex_queue(addr)->head;
+  while (p != NULL && woken < n) {
+    pcb_t* nxt = p->rq_next;
+    if (p->futex_addr == addr
+        && (!futex_private(addr) || p->proc == current->proc)) {
+      wq_remove(p);
+      make_ready(p, STATUS_READY);
+      woken++;
+    }
+    p = nxt;
+  }
+  spin_unlock(&proc_lock);
+  return woken;
 }
 
 void init_timer() {
@@ -611,20 +2174,41 @@ void init_timer() {
    * - enabling IRQ interrupts.
    */
 
-  TIMER0->Timer1Load  =  INTERVAL ; // select period
-  TIMER0->Timer1Ctrl  = 0x00000002; // select 32-bit   timer
-  TIMER0->Timer1Ctrl |= 0x00000040; // select periodic timer
-  TIMER0->Timer1Ctrl |= 0x00000020; // enable          timer interrupt
-  TIMER0->Timer1Ctrl |= 0x00000080; // enable          timer
+  timer_init(INTERVAL);             // select period, start clock
 
   GICC0->PMR          = 0x000000F0; // unmask all            interrupts
   GICD0->ISENABLER1  |= 0x00000010; // enable timer          interrupt
+  GICD0->ITARGETSR[ GIC_SOURCE_TIMER0 / 4 ] 
+                     |= 0x01 << ( 8 * ( GIC_SOURCE_TIMER0 % 4 ) );
+                                    // route  timer          interrupt to core 0
+  GICD0->ISENABLER1  |= 0x00000020; // enable real-time timer interrupt
+  GICD0->ITARGETSR[ GIC_SOURCE_TIMER1 / 4 ] 
+                     |= 0x01 << ( 8 * ( GIC_SOURCE_TIMER1 % 4 ) );
+                                    // route  real-time timer interrupt to core 0
   GICC0->CTLR         = 0x00000001; // enable GIC interface
   GICD0->CTLR         = 0x00000001; // enable GIC distributor
 
   int_enable_irq();
 }
 
+void init_tty() {
+  tty_init(&tty0, UART0);
+
+  GICD0->ISENABLER1  |= 0x00001000; // enable UART0          interrupt
+  GICD0->ITARGETSR[ GIC_SOURCE_UART0 / 4 ] 
+                     |= 0x01 << ( 8 * ( GIC_SOURCE_UART0 % 4 ) );
+                                    // route  UART0          interrupt to core 0
+}
+
+void init_caches() {
+  slab_init(&fdte_cache,    "fdte",    sizeof(fdte_t),    4, 32);
+  slab_init(&pipe_cache,    "pipe",    sizeof(pipe_t),    4, 2);
+  slab_init(&path_cache,    "path",    PATH_SIZE,         4, 16);
+  slab_init(&vfp_cache,     "vfp",     sizeof(vfp_t),     8, 8);
+  slab_init(&sem_cache,     "sem",     sizeof(sem_t),     4, 16);
+  slab_init(&proc_cache,    "proc",    sizeof(proc_t),    4, 8);
+}
+
 void init_fs() {
   k_print("Boot: Loading file system… ");
   vol.blk_0 = 0;
@@ -647,19 +2231,19 @@ void init_fs() {
     k_print(vol.outcome == FS2_SUCCESS ? "success!\n" : "fail.\n");
   }
   // Init STDIN, STDOUT, STDERR
-  fdte_t* fd = malloc(sizeof(fdte_t));
+  fdte_t* fd = slab_alloc(&fdte_cache);
   fd->type = FT_UART;
   fd->id   = (uint32_t) UART0;
   fd->mode = FM_R;
   openft[0] = fd;
 
-  fd = malloc(sizeof(fdte_t));
+  fd = slab_alloc(&fdte_cache);
   fd->type = FT_UART;
   fd->id   = (uint32_t) UART0;
   fd->mode = FM_W;
   openft[1] = fd;
 
-  fd = malloc(sizeof(fdte_t));
+  fd = slab_alloc(&fdte_cache);
   fd->type = FT_UART;
   fd->id   = (uint32_t) UART0;
   fd->mode = FM_W;
@@ -670,47 +2254,276 @@ void init_fs() {
 //    INTERRUPT HANDLERS    //
 //////////////////////////////
 
-void hilevel_handler_rst(ctx_t* ctx) {
+extern void lolevel_handler_smp();
+
+void hilevel_handler_rst() {
+  smp_join();
+  vm_init();
+  vm_enable(CACHES);
+  vfp_init();
+  init_cpu(this_cpu());
+  online_mask = 1 << cpu_id();
+  init_caches();
   init_fs();
+  init_tty();
   k_print("Boot: Loading boot programs\n");  
   pcb_t* p1 = new_user_proc(( uint32_t ) INIT_PROGRAM, 5);
 
   k_print("Boot: Launching shell\n-------- Boot Complete --------\n");
-  context_switch(NULL, p1, ctx, STATUS_CREATED);
+  context_switch(NULL, p1, STATUS_CREATED);
 
   init_timer();
+  //The clock has only just started: charge the shell from now
+  this_cpu()->exec_start = timer_now();
+  #if NCPU > 1
+  k_print("Boot: Starting secondary cores\n");
+  smp_boot(&lolevel_handler_smp);
+  #endif
   return;
 }
 
-void hilevel_handler_irq(ctx_t* ctx) {
-  uint32_t id = GICC0->IAR;
+//Entry point for secondary cores, which start out idle
+void hilevel_handler_smp() {
+  cpu_t* cpu = this_cpu();
+  smp_join();
+  vm_enable(CACHES);
+  vfp_init();
+  init_cpu(cpu);
+
+  GICC0->PMR          = 0x000000F0; // unmask all            interrupts
+  GICC0->CTLR         = 0x00000001; // enable GIC interface (banked per core)
+
+  spin_lock(&proc_lock);
+  online_mask |= 1 << cpu_id();
+  idle_mask   |= 1 << cpu_id();
+  context_switch(NULL, &cpu->idle, STATUS_CREATED);
+  spin_unlock(&proc_lock);
+}
+
+//Carry out the kill of p, made while it was executing on another core, if
+//it has not been already. If p has been switched away from since, and is
+//not yet running again elsewhere, it goes from whichever queue it is on;
+//once running elsewhere, it is left for that core to find. Call with no
+//locks held: its files are closed under file_lock, taken before proc_lock.
+void kill_pending(pcb_t* p) {
+  spin_lock(&file_lock);
+  spin_lock(&proc_lock);
+  if (p->killed && p->proc != NULL) {
+    if (p == current) {
+      terminate(current);
+      next(STATUS_TERMINATED);
+    }
+    else if (p->status != STATUS_EXECUTING) terminate(p);
+  }
+  spin_unlock(&proc_lock);
+  spin_unlock(&file_lock);
+}
+
+void hilevel_handler_irq() {
+  uint32_t iar = GICC0->IAR;
+  //SGIs also carry the source core in [12:10]
+  uint32_t id  = iar & 0x3FF;
+  //Killed by another core while executing here: it goes before the tick can
+  //switch it away, which would leave it READY with the kill forgotten
+  if (current->killed) kill_pending(current);
+  pcb_t* self = current;
+  spin_lock(&proc_lock);
 
   if( id == GIC_SOURCE_TIMER0 ) {
-    schedule(ctx);
     TIMER0->Timer1IntClr = 0x01;
+    ticks++;
+    timer_expire();
+    //TIMER0 only interrupts this core: pass the tick on to the other busy
+    //ones, and wake idle ones if there is work queued they could steal
+    uint32_t others = online_mask & ~(1 << cpu_id());
+    sgi_send(others & ~idle_mask, SGI_TICK);
+    if (queued()) sgi_send(others & idle_mask, SGI_RESCHED);
+    schedule();
+  }
+  else if( id == SGI_TICK ) {
+    schedule();
+  }
+  else if( id == GIC_SOURCE_TIMER1 ) {
+    TIMER1->Timer1IntClr = 0x01;
+    rt_event();
+  }
+  else if( id == GIC_SOURCE_UART0 ) {
+    if (tty_rx(&tty0)) wake_all(&tty0.readers);
+    if (tty_tx(&tty0)) wake_all(&tty0.writers);
+  }
+
+  //Killed by another core while this interrupt was handled, even if the tick
+  //has switched it away
+  if (self->killed) {
+    spin_unlock(&proc_lock);
+    kill_pending(self);
+    spin_lock(&proc_lock);
   }
+  //Whatever this interrupt made ready should not wait for a tick that, if we
+  //are idle, is not coming
+  if (is_idle(current)) next(STATUS_READY);
+  //Nor should a real-time release wait for it
+  else if (should_preempt()) next(STATUS_READY);
+  #if TICKLESS_IDLE
+  //Still all idle: the one-shot has fired, or been overtaken by another
+  //interrupt
+  if (idle_mask == online_mask) tick_idle();
+  #endif
 
-  GICC0->EOIR = id;
+  spin_unlock(&proc_lock);
+  GICC0->EOIR = iar;
 
   return;
 }
 
+//Terminate the current process for a fault in user mode (or in a system call
+//on its behalf), which saved ctx rather than the process's own context
+void fault_exit(ctx_t* ctx, char* why) {
+  k_print("\nProcess ");
+  k_print_int(current->pid);
+  k_print(why);
+  spin_lock(&file_lock);
+  spin_lock(&proc_lock);
+  do_exit(EXIT_KILLED);
+  next(STATUS_TERMINATED);
+  //Return via the frame to whatever runs next
+  memcpy(ctx, &current->ctx, sizeof(ctx_t));
+  spin_unlock(&proc_lock);
+  spin_unlock(&file_lock);
+}
+
+//Either a write to a page shared copy-on-write or a touch of a stack page not
+//yet populated, by the current process or by the kernel on its behalf; or a
+//bad access
+void hilevel_handler_dab(ctx_t* ctx) {
+  uint32_t far, fsr;
+  asm volatile( "mrc p15, 0, %0, c6, c0, 0 \n" // read DFAR
+                "mrc p15, 0, %1, c5, c0, 0 \n" // read DFSR
+              : "=r" (far), "=r" (fsr) );
+  uint32_t status = (fsr & 0xF) | ((fsr >> 6) & 0x10);
+  bool     write  = (fsr >> 11) & 1;
+  as_t* as = &current->proc->as;
+  bool  ok = false;
+  //Its threads share the address space, and may fault on it at once
+  spin_lock(&proc_lock);
+  //Retry the access once the page is the writer's own
+  if (status == FAULT_PERM_PAGE && write) ok = as_cow(as, far);
+  //Or once there is a page there at all
+  else if ((status == FAULT_TRANS_PAGE || status == FAULT_TRANS_SECTION)
+           && in_stack(far)) ok = as_populate(as, far);
+  spin_unlock(&proc_lock);
+  if (ok) return;
+
+  if ((ctx->cpsr & 0x1F) == 0x13 && far >= USER_BASE && far < USER_TOP) {
+    //A system call following a bad pointer its caller passed: the caller's
+    //fault. The call is abandoned (the next one resets the SVC stack), and
+    //with it every lock it held.
+    spin_abandon(&proc_lock);
+    spin_abandon(&sem_lock);
+    spin_abandon(&file_lock);
+    fault_exit(ctx, " passed a bad pointer to a system call - terminating.\n");
+    return;
+  }
+  if ((ctx->cpsr & 0x1F) != 0x10) {
+    //The kernel's own bug: nothing sensible to do
+    k_print("\nKernel data abort at ");
+    k_print_int(far);
+    halt();
+  }
+  if (in_stacks(far) && !in_stack(far))
+    fault_exit(ctx, " overflowed its stack - terminating.\n");
+  else
+    fault_exit(ctx, " made a bad memory access - terminating.\n");
+}
+
+//An instruction fetch from an unmapped or execute-never page (e.g. the
+//stack). Nothing is ever retried: it is the process's bug, or the kernel's.
+void hilevel_handler_pab(ctx_t* ctx) {
+  uint32_t far;
+  asm volatile( "mrc p15, 0, %0, c6, c0, 2 \n" // read IFAR
+              : "=r" (far) );
+  if ((ctx->cpsr & 0x1F) != 0x10) {
+    k_print("\nKernel prefetch abort at ");
+    k_print_int(far);
+    halt();
+  }
+  fault_exit(ctx, " jumped to a bad address - terminating.\n");
+}
+
+//Give the current process the VFP/NEON unit for the rest of its quantum,
+//loading its registers unless this core still holds them from its last turn
+bool vfp_claim() {
+  cpu_t* cpu = this_cpu();
+  if (current->vfp == NULL) {
+    current->vfp = slab_alloc(&vfp_cache);
+    if (current->vfp == NULL) return false;
+    memset(current->vfp, 0, sizeof(vfp_t));
+    current->vfp_cpu = -1;
+  }
+  vfp_enable();
+  if (cpu->vfp_owner != current->pid || current->vfp_cpu != cpu_id())
+    vfp_load(current->vfp);
+  cpu->vfp_owner = current->pid;
+  return true;
+}
+
+//Either the current process's first VFP/NEON instruction this quantum, or
+//one the core really cannot execute
+void hilevel_handler_und(ctx_t* ctx) {
+  if ((ctx->cpsr & 0x1F) != 0x10) {
+    //The kernel is built without VFP, so this is a bug
+    k_print("\nKernel undefined instruction at ");
+    k_print_int(ctx->pc);
+    halt();
+  }
+  //Retry it with the unit on (if that was not the problem, it traps again)
+  if (!vfp_enabled() && vfp_claim()) return;
+  fault_exit(ctx, " executed an undefined instruction - terminating.\n");
+}
+
+//The lock guarding whatever a system call touches, beyond proc_lock (which
+//the scheduler takes for itself)
+spinlock_t* svc_lock(uint32_t id) {
+  switch (id) {
+    case 0x00: case 0x05: case 0x07: case 0x0F: case 0x19: case 0x1A:
+    case 0x21: case 0x22: case 0x23: case 0x24: case 0x25:
+    case 0x26: case 0x27: case 0x28: case 0x29: case 0x2A:
+      return NULL;
+    case 0x08: case 0x09: case 0x0A: case 0x1B: case 0x1C: case 0x1D:
+    case 0x1E: case 0x1F: case 0x20:
+      return &sem_lock;
+    default: // File, pipe and FS operations; fork, exit and kill for the fd table
+      return &file_lock;
+  }
+}
+
 void hilevel_handler_svc(ctx_t* ctx, uint32_t id) {
   // int_unable_irq();
+  spinlock_t* lock = svc_lock(id);
+  //Killed by another core since it last entered the kernel
+  if (current->killed) {
+    kill_pending(current);
+    return;
+  }
+  pcb_t* self = current;
+  if (lock != NULL) spin_lock(lock);
   switch (id)
   {
     case 0: //YIELD
         #if PRINT_SWITCHES
         PL011_putc(UART0, 'y', true);
         #endif
-        next(ctx, STATUS_READY);
+        //A real-time process is done with this release
+        if (current->policy == SCHED_EDF) rt_throttle();
+        else                              next(STATUS_READY);
         break;
     case 1: { // WRITE 
         int   fd =  (int)  ( ctx->gpr[ 0 ] );  
         char* in = (char*) ( ctx->gpr[ 1 ] );  
         int    n =  (int)  ( ctx->gpr[ 2 ] ); 
         
-        ctx->gpr[0] = do_write(fd, in, n);
+        n = do_write(ctx, fd, in, n);
+        if (n != WQ_BLOCK) ctx->gpr[0] = n;
         break;
     }
     case 2: { // READ 
@@ -718,15 +2531,18 @@ void hilevel_handler_svc(ctx_t* ctx, uint32_t id) {
         char* out = (char*) ( ctx->gpr[ 1 ] );  
         int     n =  (int)  ( ctx->gpr[ 2 ] ); 
         
-        ctx->gpr[0] = do_read(fd, out, n);
+        n = do_read(ctx, fd, out, n);
+        if (n != WQ_BLOCK) ctx->gpr[0] = n;
         break;
     }
     case 3: //FORK
         do_fork(ctx);
         break;
     case 4: //EXIT
-        do_exit();
-        next(ctx, STATUS_TERMINATED);
+        spin_lock(&proc_lock);
+        do_exit((int) ctx->gpr[0]);
+        next(STATUS_TERMINATED);
+        spin_unlock(&proc_lock);
         break;
     case 5: //EXEC
         do_exec(ctx);
@@ -737,22 +2553,35 @@ void hilevel_handler_svc(ctx_t* ctx, uint32_t id) {
     case 7: { //NICE
         pid_t pid  = (pid_t) ctx->gpr[0];
         int   newp =  (int)  ctx->gpr[1];
-        if (pid < 0 || pid >= PCB_SIZE || newp < 0) break;
-        pcb[pid].base_priority = newp;
+        if (newp < 0) break;
+        if (newp > PRIORITY_MAX) newp = PRIORITY_MAX;
+        spin_lock(&proc_lock);
+        pcb_t* p = pcb_of(pid);
+        if (p != NULL) {
+          //A queued process has to move to its new level's queue
+          runq_t* rq = p->rq;
+          rq_dequeue(p);
+          p->base_priority = newp;
+          if (rq != NULL) rq_enqueue(rq, p);
+        }
+        spin_unlock(&proc_lock);
         break;
     }
     case 8: { //SEM_INIT
-        //Set semaphore sem_id to value init
-        //To avoid deadlock, use sem_post to do this as it will wake processes
-        //that are waiting for this semaphore.
+        //Set semaphore sem_id to value init, waking any waiters that
+        //satisfies so that they are not left waiting for a post
         sem_id_t sem_id = ctx->gpr[0];
         uint32_t  init  = ctx->gpr[1];
-        if (sem_id < 0 || init >= PCB_SIZE) {
+        sem_t*     s    = sem_of(sem_id);
+        if (s == NULL) {
           ctx->gpr[0] = false;
           break;
         }
-        //Post by (initial value - current) to set to initial value and wake 
-        do_sem_post(sem_id, (init - sem[sem_id]));
+        if (s->mutex) mutex_released(s);
+        s->value = init;
+        s->mutex = init == 1;
+        s->owner = -1;
+        sem_wake(s);
         //Op has succeeded
         ctx->gpr[0] = true;
         break;
@@ -766,22 +2595,25 @@ void hilevel_handler_svc(ctx_t* ctx, uint32_t id) {
     case 0xA: { //SEM_WAIT
         sem_id_t sem_id = ctx->gpr[0];
         uint32_t    x   = ctx->gpr[1];
-        if (do_sem_wait(sem_id, x)) 
-          //Did not have to wait for semaphore
-          break;
-        next(ctx, STATUS_WAITING);
+        spin_lock(&proc_lock);
+        int r = do_sem_wait(sem_id, x);
+        //Failed only if there is no such semaphore, or it is destroyed
+        //while we wait
+        ctx->gpr[0] = r != false;
+        if (r == WQ_BLOCK) next(STATUS_WAITING);
+        spin_unlock(&proc_lock);
         break;
     }
     case 0x0B: { // OPEN
       int i = 0;
-      while (i < 32 && pcb[current].fdt[i] != -1) ++i;
+      while (i < 32 && current->proc->fdt[i] != -1) ++i;
       if (i == 32) {
         ctx->gpr[0] = -1;
         break;
       }
       int f = do_open((char*) ctx->gpr[0], (char) ctx->gpr[1]);
       if (f != -1) {
-        pcb[current].fdt[i] = f;
+        current->proc->fdt[i] = f;
         ctx->gpr[0] = i;
       } else ctx->gpr[0] = -1;
       break;
@@ -796,9 +2628,9 @@ void hilevel_handler_svc(ctx_t* ctx, uint32_t id) {
       int fd2 = ctx->gpr[1];
       if (fd1 < 0 || fd2< 0 || fd1>=32 || fd2>=32) 
         {ctx->gpr[0] = false; break;}
-      int t = pcb[current].fdt[fd1];
-      pcb[current].fdt[fd1] = pcb[current].fdt[fd2];
-      pcb[current].fdt[fd2] = t;
+      int t = current->proc->fdt[fd1];
+      current->proc->fdt[fd1] = current->proc->fdt[fd2];
+      current->proc->fdt[fd2] = t;
       ctx->gpr[0] = true;
       break;
     }
@@ -843,12 +2675,98 @@ void hilevel_handler_svc(ctx_t* ctx, uint32_t id) {
       break;
     }
     case 0x18: { // GETWD
-      strncpy((char*) ctx->gpr[0], pcb[current].wd, (size_t) ctx->gpr[1]);
+      strncpy((char*) ctx->gpr[0], current->proc->wd, (size_t) ctx->gpr[1]);
       ctx->gpr[0] = true;
       break;
     }
+    case 0x19: { // SLEEP
+      do_sleep((uint32_t) ctx->gpr[0]);
+      break;
+    }
+    case 0x1A: { // UCLOCK
+      ctx->gpr[0] = timer_now();
+      break;
+    }
+    case 0x1B: { // SEM_STAT
+      ctx->gpr[0] = do_sem_stat(ctx->gpr[0], (sem_stat_t*) ctx->gpr[1]);
+      break;
+    }
+    case 0x1C: { // FUTEX_WAIT
+      int r = do_futex_wait(ctx, ctx->gpr[0], ctx->gpr[1]);
+      if (r != WQ_BLOCK) ctx->gpr[0] = r;
+      break;
+    }
+    case 0x1D: { // FUTEX_WAKE
+      ctx->gpr[0] = do_futex_wake(ctx->gpr[0], (int) ctx->gpr[1]);
+      break;
+    }
+    case 0x1E: { // SEM_CREATE
+      ctx->gpr[0] = do_sem_create((char*) ctx->gpr[0], ctx->gpr[1]);
+      break;
+    }
+    case 0x1F: { // SEM_LOOKUP
+      ctx->gpr[0] = do_sem_lookup((char*) ctx->gpr[0]);
+      break;
+    }
+    case 0x20: { // SEM_DESTROY
+      ctx->gpr[0] = do_sem_destroy(ctx->gpr[0]);
+      break;
+    }
+    case 0x21: { // THREAD
+      ctx->gpr[0] = do_thread(ctx->gpr[0], ctx->gpr[1], ctx->gpr[2]);
+      break;
+    }
+    case 0x22: { // JOIN
+      int r = do_join(ctx, (pid_t) ctx->gpr[0]);
+      if (r != WQ_BLOCK) ctx->gpr[0] = r;
+      break;
+    }
+    case 0x23: { // CPUTIME
+      ctx->gpr[0] = do_cputime((pid_t) ctx->gpr[0]);
+      break;
+    }
+    case 0x24: { // SCHED
+      ctx->gpr[0] = do_sched((pid_t) ctx->gpr[0], (int) ctx->gpr[1]);
+      break;
+    }
+    case 0x25: { // RT
+      do_rt(ctx, ctx->gpr[0], ctx->gpr[1], ctx->gpr[2]);
+      break;
+    }
+    case 0x26: { // GROUP_CREATE
+      ctx->gpr[0] = do_group_create(ctx->gpr[0], ctx->gpr[1]);
+      break;
+    }
+    case 0x27: { // GROUP_JOIN
+      ctx->gpr[0] = do_group_join((pid_t) ctx->gpr[0], (int) ctx->gpr[1]);
+      break;
+    }
+    case 0x28: { // GROUP_STAT
+      ctx->gpr[0] = do_group_stat((int) ctx->gpr[0], 
+                                  (group_stat_t*) ctx->gpr[1]);
+      break;
+    }
+    case 0x29: { // GROUP_DESTROY
+      ctx->gpr[0] = do_group_destroy((int) ctx->gpr[0]);
+      break;
+    }
+    case 0x2A: { // WAITPID
+      int r = do_waitpid(ctx, (pid_t) ctx->gpr[0], (int*) ctx->gpr[1], 
+                         (uint32_t*) ctx->gpr[2], (bool) ctx->gpr[3]);
+      if (r != WQ_BLOCK) ctx->gpr[0] = r;
+      break;
+    }
     default: // CHMOD will fall through as it is not implemented.
       break;
   }
+  //Whatever the call made ready may be due before the caller
+  spin_lock(&proc_lock);
+  if (current->status == STATUS_EXECUTING && should_preempt()) 
+    next(STATUS_READY);
+  spin_unlock(&proc_lock);
+  if (lock != NULL) spin_unlock(lock);
+  //Or during the call, which may have blocked or yielded it, so that it is
+  //no longer the one running here
+  if (self->killed) kill_pending(self);
   return;
 }
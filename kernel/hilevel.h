@@ -21,8 +21,15 @@
 #include "PL011.h"
 #include "GIC.h"
 #include "SP804.h"
+#include "VFP.h"
+#include "timer.h"
+#include "smp.h"
+#include "vm.h"
+#include "slab.h"
+#include "rbtree.h"
 
 #include "pipe.h"
+#include "tty.h"
 #include "file.h"
 #include "fs2.h"
 
@@ -38,12 +45,81 @@
 #define STDERR 2
 
 // MODIFIABLE KERNEL PROPERTIES
-#define PCB_SIZE (0x20) //Defined as such so that we can use a single variable
-                        //to keep track of allocations
-#define STACK_SIZE (0x400)
+// PIDs are a PCB slot index, tagged with a generation that is bumped each
+// time the slot is reused, so that a stale PID does not name its next occupant
+#define PID_SLOT_BITS 10
+#define PCB_MAX   (1 << PID_SLOT_BITS) // Most processes at once
+#define PCB_CHUNK 32 // PCBs are allocated this many at a time, as needed
 
-// If true, the scheduler will use ages
-#define SCHEDULE_AGES false
+// Semaphores 0 to SEM_COUNT-1 always exist, shared by everyone; named ones,
+// created on demand, take the IDs above. As with PIDs, a named semaphore's ID
+// is its slot tagged with a generation, so a stale ID names no other.
+#define SEM_COUNT  (0x20)
+#define SEM_SLOT_BITS 10
+#define SEM_NAMED_MAX (1 << SEM_SLOT_BITS)
+// Longest semaphore name, including the terminator
+#define SEM_NAME_SIZE (32)
+// Buckets in the table of semaphore names
+#define SEM_HASH_SIZE (0x40)
+// Futex waiters are hashed by address into this many queues
+#define FUTEX_BUCKETS (0x40)
+#define PIPE_COUNT (0x100)
+// Open file table entries, shared by all processes
+#define FT_SIZE    (0x200)
+// Longest path (and working directory), including the terminator
+#define PATH_SIZE  (256)
+
+// Every process's stack ends here (in its own address space), and may grow
+// down to STACK_LIMIT bytes below it. Only the top page is populated up
+// front, the rest as it is touched; the page below the limit is left unmapped
+// as a guard. Must be a multiple of PAGE_SIZE.
+#define USER_STACK_TOP USER_TOP
+#define STACK_LIMIT    (0x00040000)
+#define STACK_BOTTOM   (USER_STACK_TOP - STACK_LIMIT)
+// Threads after the first get stacks of up to THREAD_STACK_LIMIT bytes each
+// (likewise populated on demand, with a guard page), stacked below the first's
+// guard page. Each process may have THREAD_MAX of them at once; must be ≤32.
+#define THREAD_MAX          32
+#define THREAD_STACK_LIMIT  (0x00010000)
+
+// The scheduling policy the first process starts under (see SCHEDULING
+// below); others follow their parent's. Either can be changed at run time.
+#define SCHED_DEFAULT SCHED_FAIR
+// Completely fair scheduling runs whichever process has had the least CPU
+// time, weighted by priority. A process may run on until it is
+// FAIR_GRANULARITY (weighted) µs ahead of the next; one that has slept
+// rejoins at most FAIR_SLEEPER_CREDIT µs behind the rest, so it is served
+// promptly without making up for all the time it was away.
+#define FAIR_GRANULARITY    (INTERVAL)
+#define FAIR_SLEEPER_CREDIT (2 * INTERVAL)
+// Real-time processes are scheduled earliest deadline first, ahead of all
+// others, each on the core it was admitted to. A core only admits those whose
+// total density (budget / deadline) stays within EDF_DENSITY_MAX per mille,
+// leaving the rest of its time to everyone else. At most EDF_MAX at once.
+#define EDF_DENSITY_MAX 900
+#define EDF_MAX         16
+// CPU bandwidth groups: between them, a group's members get at most its quota
+// of CPU time every period, checked each tick; past that they are parked
+// until the next period. Group 0, which everyone starts in, is unlimited. At
+// most GROUP_MAX groups at once, each with a period of at least
+// GROUP_PERIOD_MIN µs.
+#define GROUP_MAX        16
+#define GROUP_PERIOD_MIN (INTERVAL)
+// Number of ready queues. Priorities above the top level are clamped to it.
+// Must not exceed 32 so that the ready bitmap fits in a single word
+#define RQ_LEVELS 32
+#define PRIORITY_MAX (RQ_LEVELS - 1)
+
+// If true, a process holding a mutex (a semaphore initialised to 1) runs at
+// the priority of its highest-priority waiter, if that is higher than its own
+#define PRIORITY_INHERITANCE true
+
+// If true, the tick is stopped while the idle task runs
+#define TICKLESS_IDLE true
+
+// If true, caches and branch prediction are enabled at boot (the MMU always
+// is). False gives the uncached baseline, for comparison (e.g. with bench)
+#define CACHES true
 
 #define PRINT_SWITCHES false
 #define PRINT_SEM_OPS  false
@@ -53,7 +129,6 @@
 #define INIT_PROGRAM &sh_main
 
 typedef int pid_t;
-typedef uint32_t sem_t;
 typedef uint32_t sem_id_t;
 
 typedef enum { 
@@ -61,6 +136,7 @@ typedef enum {
   STATUS_READY,
   STATUS_EXECUTING,
   STATUS_WAITING,
+  STATUS_SLEEPING,
   STATUS_TERMINATED
 } status_t;
 
@@ -68,39 +144,268 @@ typedef struct {
   uint32_t cpsr, pc, gpr[ 13 ], sp, lr;
 } ctx_t;
 
-typedef struct {
-  uint32_t data[STACK_SIZE];
-} stack_area_t;
-
 /////
 //// IPC
 ///
-//Used when waiting for a semaphore
+//A counting semaphore. Waiters queue in FIFO order and are only ever woken
+//from the head, so one waiting for a lot is not overtaken by later ones
+//waiting for less.
+typedef struct sem {
+  uint32_t value;
+  waitq_t  wq;
+  //Contention counters: waits, waits that had to block, and waiters woken
+  uint32_t waits;
+  uint32_t blocked;
+  uint32_t wakeups;
+  //Mutexes (initialised to 1) only: the process that holds it, or -1, and
+  //the next mutex that process holds
+  bool        mutex;
+  pid_t       owner;
+  struct sem* held_next;
+  //Named semaphores only: creates and opens not yet matched by a destroy,
+  //the next in the same hash bucket, and the name and ID
+  int         refs;
+  struct sem* hnext;
+  sem_id_t    id;
+  char        name[SEM_NAME_SIZE];
+} sem_t;
+
+#define SEM_NONE ((sem_id_t) -1)
+
+//What SEM_STAT copies out to the caller
 typedef struct {
-  //Which semaphore we wait for
-  sem_id_t  sem_id;
-  //How much we need from it to resume execution
-  uint32_t  x;    
-} semwait_t;
+  uint32_t value;
+  uint32_t waiters;
+  uint32_t waits;
+  uint32_t blocked;
+  uint32_t wakeups;
+} sem_stat_t;
 
 
 //////
-/////  PCB ENTRIES
+/////  PROCESSES
 ////
+//What a process's threads share
 typedef struct {
+  //The process's own memory (its stacks), at the same virtual addresses in
+  //every process
+  as_t     as;
+  // Reference fdtes in the global fdt
+  int      fdt[32];
+  char     wd [PATH_SIZE];
+  //Threads still running in it, and the thread stacks they occupy: bit i is
+  //set iff stack i is in use
+  int      threads;
+  uint32_t stacks;
+  //The PID of its first thread, which stands for the whole process (to its
+  //parent and children) until it has finished, and the CPU time its
+  //finished threads had between them
+  pid_t    pid;
+  uint64_t cputime;
+} proc_t;
+
+//A real-time process's reservation: it is released every period µs to run
+//for up to budget µs, and should be done within deadline µs of release
+typedef struct {
+  uint32_t period;
+  uint32_t budget;
+  uint32_t deadline;
+  //The current job's release, absolute deadline and CPU time used so far
+  uint32_t release;
+  uint32_t due;
+  uint32_t used;
+  //Out of budget (or done, having yielded) until the next release
+  bool     throttled;
+} rt_t;
+
+//A CPU bandwidth group. Its members are held back (throttled) from using
+//more than quota µs of CPU time per period µs, or not at all for a quota of 0
+typedef struct {
+  bool     used;
+  uint32_t quota;
+  uint32_t period;
+  //How many processes are in it, and the first of them (linked through their
+  //group_next/group_prev)
+  int         members;
+  struct pcb* first;
+  //When the current period began, and the CPU time had since (plus any it
+  //ran over by in the last)
+  uint32_t start;
+  uint32_t runtime;
+  //Out of quota until the next period, since throttled_at. Members wait on
+  //parked meanwhile, and timer releases them
+  bool     throttled;
+  uint32_t throttled_at;
+  waitq_t  parked;
+  tmr_t    timer;
+  //Totals: CPU time had, time spent throttled (µs), and times throttled
+  uint64_t usage;
+  uint64_t throttled_time;
+  uint32_t throttles;
+} group_t;
+
+//What GROUP_STAT copies out to the caller
+typedef struct {
+  uint32_t quota;
+  uint32_t period;
+  uint32_t members;
+  uint32_t usage;
+  uint32_t throttled_time;
+  uint32_t throttles;
+} group_stat_t;
+
+//////
+/////  PCB ENTRIES
+////
+typedef struct pcb {
   pid_t    pid;
   status_t status;
   int base_priority;
-#if SCHEDULE_AGES
-  int age;
-#endif
-  //Keep track of which (if any) semaphore this process is waiting for, 
-  //and the quantity it needs from it
-  semwait_t*    waiting;
-  //Point to the base of the 4KiB area in memory assigned to this process's stack
-  stack_area_t* stack;
-  // Reference fdtes in the global fdt
-  int      fdt[32];
-  char     wd [256];
+  //Links into a ready queue while the process is CREATED or READY
+  struct pcb* rq_next;
+  struct pcb* rq_prev;
+  //The ready queue the process is on, or NULL
+  void*       rq;
+  //The wait queue the process is blocked on (reusing the links above), or NULL
+  waitq_t*    wq;
+  //The core the process last ran (or was queued) on
+  int         cpu;
+  //Tick at which the process last joined a ready queue. With ages, the time
+  //spent queued since then *is* the age, so nothing has to be touched per tick
+  uint32_t enqueued_at;
+  //The policy it is scheduled by
+  int       policy;
+  //Real-time processes only
+  rt_t      rt;
+  //The bandwidth group it is in, and the links to the rest of its members
+  int         group;
+  struct pcb* group_next;
+  struct pcb* group_prev;
+  //Fair and real-time scheduling: where the process is in its ready queue's
+  //tree. Fair only: the CPU time it has had, in µs scaled by NICE_0_WEIGHT /
+  //its weight
+  rb_node_t rq_node;
+  uint64_t  vruntime;
+  //CPU time the process has had, in µs
+  uint64_t  cputime;
+  //While queued on a semaphore, which and the quantity it is waiting for
+  struct sem*   sem_on;
+  uint32_t      sem_need;
+  //Priority inherited from the waiters on mutexes it holds, or -1, and the
+  //first of those mutexes
+  int           inherited;
+  struct sem*   held;
+  //While queued on a futex, the address it is waiting on
+  uint32_t      futex_addr;
+  //Wakes the process when SLEEPING
+  tmr_t         sleep_timer;
+  //The process this is a thread of, and the thread stack it runs on (-1 for
+  //the first thread's, at USER_STACK_TOP)
+  proc_t*       proc;
+  int           tstack;
+  //Threads waiting to join this one
+  waitq_t       exitq;
+  //Killed while executing on another core, which terminates it when next it
+  //can. Kept apart from status, which switches overwrite.
+  bool          killed;
+  //First threads only: the process that forked it (-1 for none, or if that
+  //has gone), which waits on its childq for its children to finish. The
+  //first thread's PCB outlasts it while other threads of the process run,
+  //and a finished child stays a zombie, with the exit status its first
+  //thread gave and the CPU time all its threads had, until reaped. Its
+  //children are listed from first_child, through their next_siblings.
+  pid_t         parent;
+  struct pcb*   first_child;
+  struct pcb*   next_sibling;
+  waitq_t       childq;
+  bool          zombie;
+  int           exit_status;
+  //The process's VFP/NEON registers, allocated on first use (else NULL), and
+  //the core whose registers they were last saved from
+  vfp_t*        vfp;
+  int           vfp_cpu;
   ctx_t    ctx;
 } pcb_t;
+
+
+//////
+/////  SCHEDULING
+////
+//One FIFO per priority level, plus a bitmap with bit i set iff level i is
+//non-empty, so the highest non-empty level is found with one CLZ
+typedef struct {
+  pcb_t*   head[RQ_LEVELS];
+  pcb_t*   tail[RQ_LEVELS];
+  uint32_t bitmap;
+} rq_levels_t;
+
+//A core's ready queue, in which each policy keeps its processes its own way.
+//Fair scheduling keeps them in a tree by vruntime, the least first;
+//vruntimes only mean anything relative to the queue's min_vruntime, which
+//never goes backwards. Real-time scheduling keeps them in a tree by deadline.
+typedef struct {
+  rq_levels_t rr;
+  rq_levels_t aged;
+  rb_tree_t   fair;
+  rb_tree_t   edf;
+  uint64_t    min_vruntime;
+  int         count;
+} runq_t;
+
+//A fair-scheduled process's weight at the default priority (5)
+#define NICE_0_WEIGHT 1024
+
+//Per-core scheduler state
+typedef struct {
+  pcb_t*   running;
+  runq_t   runq;
+  //Ticks the current process has run for (RR)
+  int      runtime;
+  //When the current process was last charged for its CPU time
+  uint32_t exec_start;
+  //Total density of the real-time processes admitted here, per mille
+  uint32_t rt_density;
+  //Runs when nothing else can. It has no PID and is never queued
+  pcb_t    idle;
+  uint32_t idle_stack[0x40];
+  //The process whose VFP/NEON registers this core last loaded
+  pid_t    vfp_owner;
+} cpu_t;
+
+#define IDLE_PID (-1)
+//The exit status of a process that was killed, or ended for a fault
+#define EXIT_KILLED (-1)
+
+//A scheduling policy. When picking what to run next, policies are tried in
+//order of rank, lowest first, so a process under one always runs ahead of
+//any under a higher-ranked one.
+typedef struct {
+  char*  name;
+  int    rank;
+  //If true, its processes stay on the core they are on: no core steals them
+  bool   pinned;
+  //Add p to / take p off rq
+  void   (*enqueue)  (runq_t* rq, pcb_t* p);
+  void   (*dequeue)  (runq_t* rq, pcb_t* p);
+  //The process of this policy that should run next from rq, without
+  //dequeuing it, or NULL if there is none
+  pcb_t* (*pick_next)(runq_t* rq);
+  //Called each tick that cur, of this policy, runs on cpu, next being
+  //pick_next's choice. Returns whether cur should make way for next
+  bool   (*tick)     (cpu_t* cpu, pcb_t* cur, pcb_t* next);
+  //Whether next, of this policy and just queued, should take over from cur
+  //at once, rather than waiting for a tick. May be NULL, for never
+  bool   (*preempt)  (pcb_t* cur, pcb_t* next);
+} sched_ops_t;
+
+//Policy IDs, as given to SCHED
+#define SCHED_RR       0 // Weighted round-robin, by quanta of priority ticks
+#define SCHED_AGES     1 // Priority ageing
+#define SCHED_FAIR     2 // Completely fair
+#define SCHED_EDF      3 // Real-time, earliest deadline first (set with RT)
+#define SCHED_POLICIES 4
+
+extern cpu_t cpus[NCPU];
+#define this_cpu() (&cpus[cpu_id()])
+//The process executing on this core
+#define current    (this_cpu()->running)
@@ -12,55 +12,162 @@
  */
 
 .global lolevel_handler_rst
+.global lolevel_handler_smp
 .global lolevel_handler_irq
 .global lolevel_handler_svc
+.global lolevel_handler_pab
+.global lolevel_handler_dab
+.global lolevel_handler_und
+
+/* Rather than on the stack, the IRQ and SVC handlers save the USR registers
+ * straight into the context lolevel_ctx[ core ] points at, i.e., into the
+ * PCB of the process this core is running, and restore from wherever it
+ * points on the way out: a context switch is then just a change of pointer.
+ */
 
 lolevel_handler_rst: bl    int_init                @ initialise interrupt vector table
 
                      msr   cpsr, #0xD2             @ enter IRQ mode with IRQ and FIQ interrupts disabled
                      ldr   sp, =tos_irq            @ initialise IRQ mode stack
+                     msr   cpsr, #0xD7             @ enter ABT mode with IRQ and FIQ interrupts disabled
+                     ldr   sp, =tos_abt            @ initialise ABT mode stack
+                     msr   cpsr, #0xDB             @ enter UND mode with IRQ and FIQ interrupts disabled
+                     ldr   sp, =tos_und            @ initialise UND mode stack
                      msr   cpsr, #0xD3             @ enter SVC mode with IRQ and FIQ interrupts disabled
                      ldr   sp, =tos_svc            @ initialise SVC mode stack
 
-                     sub   sp, sp, #68             @ initialise dummy context
-
-                     mov   r0, sp                  @ set    high-level C function arg. = S
                      bl    hilevel_handler_rst     @ invoke high-level C function
+                     b     lolevel_restore         @ launch first process
+
+lolevel_handler_smp: mrc   p15, 0, r1, c0, c0, 5   @ read   MPIDR
+                     and   r1, r1, #0x3            @ extract core index
+
+                     msr   cpsr, #0xD2             @ enter IRQ mode with IRQ and FIQ interrupts disabled
+                     ldr   sp, =tos_irq            @ initialise IRQ mode stack
+                     sub   sp, sp, r1, lsl #12     @ ... offset 4KiB per core
+                     msr   cpsr, #0xD7             @ enter ABT mode with IRQ and FIQ interrupts disabled
+                     ldr   sp, =tos_abt            @ initialise ABT mode stack
+                     sub   sp, sp, r1, lsl #12     @ ... offset 4KiB per core
+                     msr   cpsr, #0xDB             @ enter UND mode with IRQ and FIQ interrupts disabled
+                     ldr   sp, =tos_und            @ initialise UND mode stack
+                     sub   sp, sp, r1, lsl #12     @ ... offset 4KiB per core
+                     msr   cpsr, #0xD3             @ enter SVC mode with IRQ and FIQ interrupts disabled
+                     ldr   sp, =tos_svc            @ initialise SVC mode stack
+                     sub   sp, sp, r1, lsl #12     @ ... offset 4KiB per core
+
+                     bl    hilevel_handler_smp     @ invoke high-level C function
+                     b     lolevel_restore         @ launch idle task
+
+lolevel_handler_irq: sub   lr, lr, #4              @ correct return address
+                     push  { r0, r1 }              @ free     scratch registers
+                     mrc   p15, 0, r0, c0, c0, 5   @ read     MPIDR
+                     and   r0, r0, #0x3            @ extract  core index
+                     ldr   r1, =lolevel_ctx        @ load     current context address
+                     ldr   r0, [ r1, r0, lsl #2 ]
+                     mrs   r1, spsr                @ move     USR        CPSR
+                     stmia r0, { r1, lr }          @ store    USR PC and CPSR
+                     add   r1, r0, #16             @ skip     to r2
+                     stmia r1, { r2-r12, sp, lr }^ @ preserve USR registers
+                     pop   { r1, r2 }              @ ... and  scratch registers
+                     str   r1, [ r0, #8 ]
+                     str   r2, [ r0, #12 ]
+
+                     bl    hilevel_handler_irq     @ invoke high-level C function
+                     b     lolevel_restore         @ return to whichever process is current
+
+lolevel_handler_svc: sub   lr, lr, #0              @ correct return address
+                     push  { r0, r1 }              @ free     scratch registers
+                     mrc   p15, 0, r0, c0, c0, 5   @ read     MPIDR
+                     and   r0, r0, #0x3            @ extract  core index
+                     ldr   r1, =lolevel_ctx        @ load     current context address
+                     ldr   r0, [ r1, r0, lsl #2 ]
+                     mrs   r1, spsr                @ move     USR        CPSR
+                     stmia r0, { r1, lr }          @ store    USR PC and CPSR
+                     add   r1, r0, #16             @ skip     to r2
+                     stmia r1, { r2-r12, sp, lr }^ @ preserve USR registers
+                     pop   { r1, r2 }              @ ... and  scratch registers
+                     str   r1, [ r0, #8 ]
+                     str   r2, [ r0, #12 ]
+
+                     mrc   p15, 0, r2, c0, c0, 5   @ read     MPIDR
+                     and   r2, r2, #0x3            @ extract  core index
+                     ldr   sp, =tos_svc            @ reset    SVC mode stack, dropping any call
+                     sub   sp, sp, r2, lsl #12     @ ... a fault cut short (4KiB per core)
 
-                     ldmia sp!, { r0, lr }         @ load     USR mode PC and CPSR
-                     msr   spsr, r0                @ move     USR mode        CPSR
+                                                   @ set    high-level C function arg. = context (r0)
+                     ldr   r1, [ lr, #-4 ]         @ load                     svc instruction
+                     bic   r1, r1, #0xFF000000     @ set    high-level C function arg. = svc immediate
+                     bl    hilevel_handler_svc     @ invoke high-level C function
+
+lolevel_restore:     mrc   p15, 0, r0, c0, c0, 5   @ read     MPIDR
+                     and   r0, r0, #0x3            @ extract  core index
+                     ldr   r1, =lolevel_ctx        @ load     (maybe new) current context address
+                     ldr   r0, [ r1, r0, lsl #2 ]
+                     ldmia r0, { r1, lr }          @ load     USR mode PC and CPSR
+                     msr   spsr_cxsf, r1           @ move     USR mode        CPSR
+                     add   r0, r0, #12             @ skip     to r1
+                     ldmia r0, { r1-r12, sp, lr }^ @ restore  USR mode registers
+                     ldr   r0, [ r0, #-4 ]         @ ... and  r0 last, being the base
+                     movs  pc, lr                  @ return from interrupt
+
+/* Data aborts may come from user mode, or from the kernel touching user
+ * memory on its behalf. Either way the faulting instruction is retried on
+ * return, so the USR register frame is saved as for any other exception:
+ * r0-r12 are shared with SVC mode, so this preserves them in both cases.
+ */
+
+lolevel_handler_dab: sub   lr, lr, #8              @ correct return address (retry instruction)
+                     sub   sp, sp, #60             @ update   ABT mode stack
+                     stmia sp, { r0-r12, sp, lr }^ @ preserve USR registers
+                     mrs   r0, spsr                @ move     aborted    CPSR
+                     stmdb sp!, { r0, lr }         @ store    aborted PC and CPSR
+
+                     mov   r0, sp                  @ set    high-level C function arg. = SP
+                     bl    hilevel_handler_dab     @ invoke high-level C function
+
+                     ldmia sp!, { r0, lr }         @ load     aborted PC and CPSR
+                     msr   spsr, r0                @ move     aborted    CPSR
                      ldmia sp, { r0-r12, sp, lr }^ @ restore  USR mode registers
-                     add   sp, sp, #60             @ update   SVC mode SP
+                     add   sp, sp, #60             @ update   ABT mode SP
                      movs  pc, lr                  @ return from interrupt
 
-lolevel_handler_irq: sub   lr, lr, #4              @ correct return address
-                     sub   sp, sp, #60             @ update   SVC mode stack
+/* Prefetch aborts are a jump to somewhere that cannot be executed, which is
+ * never retried: the frame is saved as for data aborts so that the process
+ * can be switched away from, or the kernel's own told apart.
+ */
+
+lolevel_handler_pab: sub   lr, lr, #4              @ correct return address (faulting instruction)
+                     sub   sp, sp, #60             @ update   ABT mode stack
                      stmia sp, { r0-r12, sp, lr }^ @ preserve USR registers
-                     mrs   r0, spsr                @ move     USR        CPSR
-                     stmdb sp!, { r0, lr }         @ store    USR PC and CPSR
-         
+                     mrs   r0, spsr                @ move     aborted    CPSR
+                     stmdb sp!, { r0, lr }         @ store    aborted PC and CPSR
+
                      mov   r0, sp                  @ set    high-level C function arg. = SP
-                     bl    hilevel_handler_irq     @ invoke high-level C function
-        
-                     ldmia sp!, { r0, lr }         @ load     USR mode PC and CPSR
-                     msr   spsr, r0                @ move     USR mode        CPSR
+                     bl    hilevel_handler_pab     @ invoke high-level C function
+
+                     ldmia sp!, { r0, lr }         @ load     aborted PC and CPSR
+                     msr   spsr, r0                @ move     aborted    CPSR
                      ldmia sp, { r0-r12, sp, lr }^ @ restore  USR mode registers
-                     add   sp, sp, #60             @ update   SVC mode SP
+                     add   sp, sp, #60             @ update   ABT mode SP
                      movs  pc, lr                  @ return from interrupt
 
-lolevel_handler_svc: sub   lr, lr, #0              @ correct return address
-                     sub   sp, sp, #60             @ update   SVC mode stack
+/* Undefined instructions are most often a process's first VFP/NEON instruction
+ * of its quantum, retried once the unit is enabled. The frame is saved as for
+ * data aborts, so that the kernel's own (which should never happen) can be told
+ * apart.
+ */
+
+lolevel_handler_und: sub   lr, lr, #4              @ correct return address (retry instruction, ARM state)
+                     sub   sp, sp, #60             @ update   UND mode stack
                      stmia sp, { r0-r12, sp, lr }^ @ preserve USR registers
-                     mrs   r0, spsr                @ move     USR        CPSR
-                     stmdb sp!, { r0, lr }         @ store    USR PC and CPSR
-         
+                     mrs   r0, spsr                @ move     faulting   CPSR
+                     stmdb sp!, { r0, lr }         @ store    faulting PC and CPSR
+
                      mov   r0, sp                  @ set    high-level C function arg. = SP
-                     ldr   r1, [ lr, #-4 ]         @ load                     svc instruction
-                     bic   r1, r1, #0xFF000000     @ set    high-level C function arg. = svc immediate
-                     bl    hilevel_handler_svc     @ invoke high-level C function
-        
-                     ldmia sp!, { r0, lr }         @ load     USR mode PC and CPSR
-                     msr   spsr, r0                @ move     USR mode        CPSR
+                     bl    hilevel_handler_und     @ invoke high-level C function
+
+                     ldmia sp!, { r0, lr }         @ load     faulting PC and CPSR
+                     msr   spsr, r0                @ move     faulting   CPSR
                      ldmia sp, { r0-r12, sp, lr }^ @ restore  USR mode registers
-                     add   sp, sp, #60             @ update   SVC mode SP
+                     add   sp, sp, #60             @ update   UND mode SP
                      movs  pc, lr                  @ return from interrupt
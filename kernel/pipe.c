@@ -8,19 +8,28 @@
 #include "pipe.h"
 
 void pipe_reset(pipe_t* pipe) {
-    pipe->reader     = 0;
-    pipe->writer     = 0;
-    pipe->full       = false;
-    pipe->reader_pid = -1;
-    pipe->writer_pid = -1;
+    pipe->reader       = 0;
+    pipe->writer       = 0;
+    pipe->full         = false;
+    pipe->rclosed      = false;
+    pipe->wclosed      = false;
+    pipe->readers.head = pipe->readers.tail = 0;
+    pipe->writers.head = pipe->writers.tail = 0;
 }
 
 bool can_read(pipe_t* pipe) {
     return  pipe->full || (pipe->writer != pipe->reader);
 }
 
+int space(pipe_t* pipe) {
+    if (pipe->full) return 0;
+    return (pipe->reader - pipe->writer + PIPE_SIZE - 1) % PIPE_SIZE + 1;
+}
+
 int pipe_read(pipe_t* pipe, char* out, int nchars) {
-    int i;
+    if (nchars > 0 && !can_read(pipe)) 
+        return pipe->wclosed ? 0 : WQ_BLOCK;
+    int i = 0;
     while (i < nchars && can_read(pipe)) {
         out[i] = pipe->buffer[pipe->reader];
         i++;
@@ -31,7 +40,10 @@ int pipe_read(pipe_t* pipe, char* out, int nchars) {
 }
 
 int pipe_write(pipe_t* pipe, char* in, int nchars) {
-    int i;
+    if (pipe->rclosed) return -1;
+    if (nchars <= PIPE_SIZE ? space(pipe) < nchars : pipe->full) 
+        return WQ_BLOCK;
+    int i = 0;
     while (i < nchars && !pipe->full) {
         pipe->buffer[pipe->writer] = in[i];
         i++;
@@ -39,4 +51,4 @@ int pipe_write(pipe_t* pipe, char* in, int nchars) {
         pipe->full = pipe->writer == pipe->reader;
     }
     return i;
-}
\ No newline at end of file
+}
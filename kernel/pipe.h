@@ -5,22 +5,38 @@
  * LICENSE.txt within the associated archive or repository).
  */
 
+#ifndef __PIPE_H
+#define __PIPE_H
+
 #define PIPE_SIZE 0x1000
 
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "waitq.h"
+
 //Pipe
 typedef struct {
   char buffer[PIPE_SIZE];
   uint32_t reader;
   uint32_t writer;
   bool full;
-  int reader_pid;
-  int writer_pid;
+  //Set once every descriptor for that end has been closed
+  bool rclosed;
+  bool wclosed;
+  //Processes waiting for data / for space
+  waitq_t readers;
+  waitq_t writers;
 } pipe_t;
 
 void pipe_reset (pipe_t* pipe);
 
+//Read up to nchars, returning how many were read; 0 at EOF (empty, and the
+//write end closed) or WQ_BLOCK if empty but not at EOF
 int  pipe_read (pipe_t* pipe, char* out, int nchars);
-int  pipe_write (pipe_t* pipe, char* in, int nchars);
\ No newline at end of file
+//Write nchars, returning how many were written; -1 if the read end is
+//closed. Writes of up to PIPE_SIZE are all-or-nothing, returning WQ_BLOCK
+//until there is space for all of it; longer ones write what fits.
+int  pipe_write (pipe_t* pipe, char* in, int nchars);
+
+#endif
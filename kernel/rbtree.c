@@ -0,0 +1,203 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "rbtree.h"
+
+// Missing children (NULL) count as black
+bool rb_red(rb_node_t* n) {
+  return n != NULL && n->red;
+}
+
+// Put v where u is in u's parent (or at the root). v may be NULL
+void rb_replace(rb_tree_t* t, rb_node_t* u, rb_node_t* v) {
+  if      (u->parent == NULL)         t->root           = v;
+  else if (u == u->parent->left)      u->parent->left  = v;
+  else                                u->parent->right = v;
+  if (v != NULL) v->parent = u->parent;
+}
+
+void rb_rotate_left(rb_tree_t* t, rb_node_t* x) {
+  rb_node_t* y = x->right;
+  x->right = y->left;
+  if (y->left != NULL) y->left->parent = x;
+  rb_replace(t, x, y);
+  y->left   = x;
+  x->parent = y;
+}
+
+void rb_rotate_right(rb_tree_t* t, rb_node_t* x) {
+  rb_node_t* y = x->left;
+  x->left = y->right;
+  if (y->right != NULL) y->right->parent = x;
+  rb_replace(t, x, y);
+  y->right  = x;
+  x->parent = y;
+}
+
+void rb_insert(rb_tree_t* t, rb_node_t* n, rb_less_t less) {
+  rb_node_t*  p     = NULL;
+  rb_node_t** link  = &t->root;
+  bool        first = true;
+  while (*link != NULL) {
+    p = *link;
+    if (less(n, p)) link = &p->left;
+    else {
+      link  = &p->right;
+      first = false;
+    }
+  }
+  n->parent = p;
+  n->left   = n->right = NULL;
+  n->red    = true;
+  *link     = n;
+  if (first) t->first = n;
+
+  //n is red, so only a red parent breaks the rules. The root is black, so a
+  //red parent has a parent of its own
+  while ((p = n->parent) != NULL && p->red) {
+    rb_node_t* g = p->parent;
+    if (p == g->left) {
+      rb_node_t* u = g->right;
+      if (rb_red(u)) {
+        //Push the red up to g, and carry on from there
+        p->red = u->red = false;
+        g->red = true;
+        n      = g;
+        continue;
+      }
+      if (n == p->right) {
+        rb_rotate_left(t, p);
+        n = p;
+        p = n->parent;
+      }
+      p->red = false;
+      g->red = true;
+      rb_rotate_right(t, g);
+    }
+    else {
+      rb_node_t* u = g->left;
+      if (rb_red(u)) {
+        p->red = u->red = false;
+        g->red = true;
+        n      = g;
+        continue;
+      }
+      if (n == p->left) {
+        rb_rotate_right(t, p);
+        n = p;
+        p = n->parent;
+      }
+      p->red = false;
+      g->red = true;
+      rb_rotate_left(t, g);
+    }
+  }
+  t->root->red = false;
+}
+
+//x (perhaps NULL), child of p, is short of one black on its paths
+void rb_erase_fixup(rb_tree_t* t, rb_node_t* x, rb_node_t* p) {
+  while (x != t->root && !rb_red(x)) {
+    if (x == p->left) {
+      rb_node_t* w = p->right;
+      if (w->red) {
+        w->red = false;
+        p->red = true;
+        rb_rotate_left(t, p);
+        w = p->right;
+      }
+      if (!rb_red(w->left) && !rb_red(w->right)) {
+        //Take a black off the sibling's side too, and push the shortfall up
+        w->red = true;
+        x      = p;
+        p      = x->parent;
+        continue;
+      }
+      if (!rb_red(w->right)) {
+        w->left->red = false;
+        w->red       = true;
+        rb_rotate_right(t, w);
+        w = p->right;
+      }
+      w->red        = p->red;
+      p->red        = false;
+      w->right->red = false;
+      rb_rotate_left(t, p);
+      x = t->root;
+    }
+    else {
+      rb_node_t* w = p->left;
+      if (w->red) {
+        w->red = false;
+        p->red = true;
+        rb_rotate_right(t, p);
+        w = p->left;
+      }
+      if (!rb_red(w->left) && !rb_red(w->right)) {
+        w->red = true;
+        x      = p;
+        p      = x->parent;
+        continue;
+      }
+      if (!rb_red(w->left)) {
+        w->right->red = false;
+        w->red        = true;
+        rb_rotate_left(t, w);
+        w = p->left;
+      }
+      w->red       = p->red;
+      p->red       = false;
+      w->left->red = false;
+      rb_rotate_right(t, p);
+      x = t->root;
+    }
+  }
+  if (x != NULL) x->red = false;
+}
+
+void rb_erase(rb_tree_t* t, rb_node_t* n) {
+  if (t->first == n) t->first = rb_next(n);
+  rb_node_t* x;
+  rb_node_t* p;
+  bool       black;
+  if (n->left == NULL || n->right == NULL) {
+    //At most one child, which takes n's place
+    x     = n->left != NULL ? n->left : n->right;
+    p     = n->parent;
+    black = !n->red;
+    rb_replace(t, n, x);
+  }
+  else {
+    //n's successor, which has no left child, takes its place
+    rb_node_t* s = n->right;
+    while (s->left != NULL) s = s->left;
+    x     = s->right;
+    black = !s->red;
+    if (s->parent == n) p = s;
+    else {
+      p = s->parent;
+      rb_replace(t, s, x);
+      s->right         = n->right;
+      s->right->parent = s;
+    }
+    rb_replace(t, n, s);
+    s->left         = n->left;
+    s->left->parent = s;
+    s->red          = n->red;
+  }
+  if (black) rb_erase_fixup(t, x, p);
+}
+
+rb_node_t* rb_next(rb_node_t* n) {
+  if (n->right != NULL) {
+    n = n->right;
+    while (n->left != NULL) n = n->left;
+    return n;
+  }
+  while (n->parent != NULL && n == n->parent->right) n = n->parent;
+  return n->parent;
+}
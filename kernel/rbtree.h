@@ -0,0 +1,44 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __RBTREE_H
+#define __RBTREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A red-black tree, linked through nodes embedded in its members (so neither
+// inserting nor erasing allocates). Insert and erase are O(log n); the
+// leftmost (least) node is cached, so finding it is O(1). Equal keys keep
+// the order they were inserted in.
+typedef struct rb_node {
+  struct rb_node* parent;
+  struct rb_node* left;
+  struct rb_node* right;
+  bool            red;
+} rb_node_t;
+
+typedef struct {
+  rb_node_t* root;
+  rb_node_t* first;
+} rb_tree_t;
+
+// Orders the tree: true iff a's key is less than b's
+typedef bool (*rb_less_t)(rb_node_t* a, rb_node_t* b);
+
+// The struct of the given type that node n is member of
+#define rb_entry(n, type, member) \
+  ((type*) ((char*) (n) - offsetof(type, member)))
+
+// Add n to t, after any nodes equal to it
+void       rb_insert(rb_tree_t* t, rb_node_t* n, rb_less_t less);
+// Take n, which must be in t, out of it
+void       rb_erase (rb_tree_t* t, rb_node_t* n);
+// The node after n in order, or NULL if n is the last
+rb_node_t* rb_next  (rb_node_t* n);
+
+#endif
@@ -0,0 +1,58 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include <malloc.h>
+
+#include "slab.h"
+
+void slab_init(slab_t* c, char* name, size_t size, size_t align, int per_slab) {
+  // Every object has to be able to hold the free list link, and keep the next
+  // one aligned
+  if (size < sizeof(void*)) size = sizeof(void*);
+  if (align < sizeof(void*)) align = sizeof(void*);
+  c->name     = name;
+  c->size     = (size + align - 1) & ~(align - 1);
+  c->align    = align;
+  c->per_slab = per_slab;
+  c->free     = NULL;
+  c->lock     = (spinlock_t) SPINLOCK_INIT;
+  c->in_use   = c->peak = c->allocs = c->slabs = 0;
+}
+
+//Carve a new slab into free objects. Call with c->lock held.
+void grow(slab_t* c) {
+  char* slab = memalign(c->align, c->size * c->per_slab);
+  if (slab == NULL) return;
+  for (int i = c->per_slab - 1; i >= 0; --i) {
+    void** obj = (void**) (slab + i * c->size);
+    *obj    = c->free;
+    c->free = obj;
+  }
+  c->slabs++;
+}
+
+void* slab_alloc(slab_t* c) {
+  spin_lock(&c->lock);
+  if (c->free == NULL) grow(c);
+  void** obj = c->free;
+  if (obj != NULL) {
+    c->free = *obj;
+    c->allocs++;
+    if (++c->in_use > c->peak) c->peak = c->in_use;
+  }
+  spin_unlock(&c->lock);
+  return obj;
+}
+
+void slab_free(slab_t* c, void* obj) {
+  if (obj == NULL) return;
+  spin_lock(&c->lock);
+  *(void**) obj = c->free;
+  c->free = obj;
+  c->in_use--;
+  spin_unlock(&c->lock);
+}
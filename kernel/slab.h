@@ -0,0 +1,43 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __SLAB_H
+#define __SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "smp.h"
+
+// A cache of fixed-size objects. Objects are carved out of slabs, each
+// holding per_slab of them, taken from the heap as the cache runs dry; freed
+// objects go on a free list for reuse rather than back to the heap. Both
+// alloc and free are O(1) (bar growing), and the heap only ever sees
+// slab-sized requests, so does not fragment under fork/exit churn.
+typedef struct {
+  char*      name;
+  size_t     size;
+  size_t     align;
+  int        per_slab;
+  // Free objects, linked through their first word
+  void*      free;
+  spinlock_t lock;
+  // Usage counters
+  uint32_t   in_use;  // objects currently allocated
+  uint32_t   peak;    // most ever allocated at once
+  uint32_t   allocs;  // allocations, ever
+  uint32_t   slabs;   // slabs taken from the heap
+} slab_t;
+
+// Set up cache c for objects of size bytes, aligned to align (a power of 2)
+void  slab_init (slab_t* c, char* name, size_t size, size_t align, int per_slab);
+// An object from c, or NULL if out of memory
+void* slab_alloc(slab_t* c);
+// Return obj (from c, or NULL) to c
+void  slab_free (slab_t* c, void* obj);
+
+#endif
@@ -0,0 +1,84 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "smp.h"
+
+typedef struct {
+  volatile uint32_t CTRL;   // 0x0000 : control
+  volatile uint32_t CONFIG; // 0x0004 : configuration
+} SCU_t;
+
+// The snoop control unit sits at the base of the A9 MPCore private region
+SCU_t* SCU = ( SCU_t* )( 0x1F000000 );
+
+int cpu_id() {
+  #if NCPU > 1
+  uint32_t mpidr;
+  asm volatile( "mrc p15, 0, %0, c0, c0, 5 \n" // read MPIDR
+              : "=r" (mpidr) );
+  return mpidr & 0x3;
+  #else
+  return 0;
+  #endif
+}
+
+void sgi_send(uint32_t mask, int id) {
+  if (!mask) return;
+  // Target list filter 0: deliver to the cores listed in [23:16]
+  GICD0->SGIR = ((mask & 0xFF) << 16) | (id & 0xF);
+}
+
+void smp_join() {
+  #if NCPU > 1
+  // Enable the snoop control unit, which keeps the cores' L1s coherent, before
+  // anyone turns their caches on
+  if (cpu_id() == 0) SCU->CTRL |= 0x1;
+  asm volatile( "mrc p15, 0, r0, c1, c0, 1 \n" // read  ACTLR
+                "orr r0, r0, #0x40         \n" // set   ACTLR[ SMP ]
+                "mcr p15, 0, r0, c1, c0, 1 \n" // write ACTLR
+              : : : "r0" );
+  #endif
+}
+
+void smp_boot(void* entry) {
+  // The boot loader parks secondaries in WFI, waking to check SYS_FLAGS for
+  // an entry point
+  SYSCONF->FLAGSCLR = 0xFFFFFFFF;
+  SYSCONF->FLAGSSET = (uint32_t) entry;
+  // Make sure the flags are visible before the SGI wakes anyone
+  asm volatile( "dsb" ::: "memory" );
+  sgi_send(((1 << NCPU) - 1) & ~(1 << cpu_id()), SGI_WAKE);
+}
+
+void spin_lock(spinlock_t* l) {
+  int me = cpu_id();
+  if (l->owner == me) {
+    l->depth++;
+    return;
+  }
+  // ldrex/strex, with acquire semantics
+  while (__sync_lock_test_and_set(&l->locked, 1)) {
+    while (l->locked) asm volatile( "wfe" );
+  }
+  l->owner = me;
+  l->depth = 1;
+}
+
+void spin_unlock(spinlock_t* l) {
+  if (--l->depth > 0) return;
+  l->owner = -1;
+  __sync_lock_release(&l->locked);
+  // Wake anyone waiting in spin_lock
+  asm volatile( "dsb \n"
+                "sev \n" ::: "memory" );
+}
+
+void spin_abandon(spinlock_t* l) {
+  if (l->owner != cpu_id()) return;
+  l->depth = 1;
+  spin_unlock(l);
+}
@@ -0,0 +1,63 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __SMP_H
+#define __SMP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "GIC.h"
+#include "SYS.h"
+
+// The RealView PBX-A9 has a quad-core Cortex-A9 MPCore; everything else we
+// run on has one core
+#if defined( PLATFORM_PBX_A9 )
+#define NCPU 4
+#else
+#define NCPU 1
+#endif
+
+// Software generated interrupts used between cores
+#define SGI_WAKE    0 // Bring a secondary core out of the boot loader
+#define SGI_RESCHED 1 // Something was made ready for you
+#define SGI_TICK    2 // Scheduler tick, forwarded from the core with TIMER0
+
+// Index of the executing core
+int  cpu_id();
+
+// Raise SGI id on every core whose bit is set in mask
+void sgi_send(uint32_t mask, int id);
+
+// Start the secondary cores at entry
+void smp_boot(void* entry);
+// Have the executing core take part in cache coherency (before enabling its
+// caches)
+void smp_join();
+
+/////
+////  SPINLOCKS
+///
+// Locks are recursive per core: a core may re-take a lock it holds, which
+// lets the scheduler's helpers lock whatever they touch whether or not the
+// caller already has. Interrupts are masked throughout the kernel, so none
+// of these need to mask them.
+typedef struct {
+  volatile uint32_t locked;
+  volatile int      owner;
+  int               depth;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0, -1, 0 }
+
+void spin_lock  (spinlock_t* l);
+void spin_unlock(spinlock_t* l);
+// Release l outright if this core holds it, however many times over: for
+// abandoning a system call part way through
+void spin_abandon(spinlock_t* l);
+
+#endif
@@ -0,0 +1,188 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "timer.h"
+
+// Timer control register bits
+#define TC_ONESHOT  0x00000001
+#define TC_32BIT    0x00000002
+#define TC_INTEN    0x00000020
+#define TC_PERIODIC 0x00000040
+#define TC_ENABLE   0x00000080
+
+typedef struct {
+  tmr_t*   slot[WHEEL_LEVELS][WHEEL_SIZE];
+  // Timers pending on each level
+  int      pending[WHEEL_LEVELS];
+  // The next jiffy to be processed, and the clock time at which it starts
+  uint32_t now;
+  uint32_t now_us;
+} wheel_t;
+
+wheel_t wheel = {0};
+
+void timer_init(uint32_t interval) {
+  // Free-running mode counts down from 0xFFFFFFFF and wraps, without
+  // interrupting
+  TIMER0->Timer2Ctrl = 0;
+  TIMER0->Timer2Load = 0xFFFFFFFF;
+  TIMER0->Timer2Ctrl = TC_32BIT | TC_ENABLE;
+
+  wheel.now_us = timer_now();
+  timer_periodic(interval);
+}
+
+uint32_t timer_now() {
+  return ~TIMER0->Timer2Value;
+}
+
+void timer_periodic(uint32_t interval) {
+  TIMER0->Timer1Ctrl = 0;
+  TIMER0->Timer1Load = interval;
+  TIMER0->Timer1Ctrl = TC_32BIT | TC_PERIODIC | TC_INTEN | TC_ENABLE;
+}
+
+void timer_oneshot(uint32_t delta) {
+  // A load of 0 would never fire
+  if (delta == 0) delta = 1;
+  TIMER0->Timer1Ctrl = 0;
+  TIMER0->Timer1Load = delta;
+  TIMER0->Timer1Ctrl = TC_32BIT | TC_ONESHOT | TC_INTEN | TC_ENABLE;
+}
+
+void timer_stop() {
+  TIMER0->Timer1Ctrl   = 0;
+  TIMER0->Timer1IntClr = 0x01;
+}
+
+void timer_rt_oneshot(uint32_t delta) {
+  if (delta == 0) delta = 1;
+  TIMER1->Timer1Ctrl = 0;
+  TIMER1->Timer1Load = delta;
+  TIMER1->Timer1Ctrl = TC_32BIT | TC_ONESHOT | TC_INTEN | TC_ENABLE;
+}
+
+void timer_rt_stop() {
+  TIMER1->Timer1Ctrl   = 0;
+  TIMER1->Timer1IntClr = 0x01;
+}
+
+/////
+////  TIMER WHEEL
+///
+// Put t in the slot for its expiry, relative to the wheel's present
+void wheel_insert(tmr_t* t) {
+  uint32_t delta = t->expires - wheel.now;
+  int l = 0;
+  if ((int32_t) delta < 0) {
+    // Overdue (e.g. during a cascade): fire on the next jiffy processed
+    t->expires = wheel.now;
+  }
+  else {
+    while (l < WHEEL_LEVELS - 1 && delta >= (1 << (WHEEL_BITS * (l + 1)))) l++;
+    // Beyond the last level: clamp to the furthest representable jiffy
+    if (l == WHEEL_LEVELS - 1 && delta >= (1 << (WHEEL_BITS * WHEEL_LEVELS)))
+      t->expires = wheel.now + (1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+  }
+  tmr_t** slot = &wheel.slot[l][(t->expires >> (WHEEL_BITS * l)) & WHEEL_MASK];
+
+  t->prev = NULL;
+  t->next = *slot;
+  if (*slot != NULL) (*slot)->prev = t;
+  *slot   = t;
+  t->slot = slot;
+  wheel.pending[l]++;
+}
+
+int wheel_level(tmr_t** slot) {
+  return (slot - &wheel.slot[0][0]) / WHEEL_SIZE;
+}
+
+void timer_del(tmr_t* t) {
+  if (t->slot == NULL) return;
+  if (t->prev != NULL) t->prev->next = t->next;
+  else                 *t->slot      = t->next;
+  if (t->next != NULL) t->next->prev = t->prev;
+  wheel.pending[wheel_level(t->slot)]--;
+  t->slot = NULL;
+}
+
+void timer_add(tmr_t* t, uint32_t delay) {
+  timer_del(t);
+  // A jiffy is processed once it has ended, so rounding down never fires early
+  uint32_t since = timer_now() - wheel.now_us;
+  t->expires = wheel.now + ((since + delay) >> JIFFY_SHIFT);
+  wheel_insert(t);
+}
+
+// Move every timer in slot i of level l down to the level(s) below
+void wheel_cascade(int l, int i) {
+  tmr_t* t = wheel.slot[l][i];
+  wheel.slot[l][i] = NULL;
+  while (t != NULL) {
+    tmr_t* n = t->next;
+    wheel.pending[l]--;
+    wheel_insert(t);
+    t = n;
+  }
+}
+
+// Process jiffy wheel.now
+void wheel_step() {
+  int i = wheel.now & WHEEL_MASK;
+  // Each time level l wraps, bring the next slot of level l + 1 down
+  for (int l = 1; i == 0 && l < WHEEL_LEVELS; ++l) {
+    i = (wheel.now >> (WHEEL_BITS * l)) & WHEEL_MASK;
+    wheel_cascade(l, i);
+  }
+  tmr_t** slot = &wheel.slot[0][wheel.now & WHEEL_MASK];
+  while (*slot != NULL) {
+    tmr_t* t = *slot;
+    timer_del(t);
+    t->fire(t);
+  }
+  wheel.now++;
+  wheel.now_us += JIFFY_US;
+}
+
+void timer_expire() {
+  uint32_t elapsed = (timer_now() - wheel.now_us) >> JIFFY_SHIFT;
+  bool     empty   = true;
+  for (int l = 0; l < WHEEL_LEVELS; ++l) empty = empty && !wheel.pending[l];
+  if (empty) {
+    // Nothing to fire, so skip straight to the present
+    wheel.now    += elapsed;
+    wheel.now_us += elapsed << JIFFY_SHIFT;
+    return;
+  }
+  while (elapsed--) wheel_step();
+}
+
+bool timer_next_due(uint32_t* at) {
+  uint32_t due   = 0;
+  bool     found = false;
+  // The first occupied level 0 slot (slots behind now belong to the next
+  // rotation, hence wrapping around)
+  for (int k = 0; k < WHEEL_SIZE && !found; ++k) {
+    if (wheel.slot[0][(wheel.now + k) & WHEEL_MASK] != NULL) {
+      due   = k;
+      found = true;
+    }
+  }
+  // Higher levels are only known to the resolution of their slots, so wake
+  // up at the next cascade to see what comes down
+  int higher = 0;
+  for (int l = 1; l < WHEEL_LEVELS; ++l) higher += wheel.pending[l];
+  if (higher) {
+    uint32_t cascade = WHEEL_SIZE - (wheel.now & WHEEL_MASK);
+    if (!found || cascade < due) due = cascade;
+    found = true;
+  }
+  // Jiffy now + due is processed once it has *ended*
+  if (found) *at = wheel.now_us + ((due + 1) << JIFFY_SHIFT);
+  return found;
+}
@@ -0,0 +1,79 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __TIMER_H
+#define __TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "SP804.h"
+
+// The SP804s are clocked at 1MHz, so one count is one microsecond
+#define TIMER_HZ 1000000
+
+// Timer1 of TIMER0 raises the scheduler tick; Timer2 free-runs as a clock
+
+// Start the clock, and the tick with the given period (in µs)
+void     timer_init    (uint32_t interval);
+// Microseconds since timer_init. Wraps after ~71 minutes, so only compare
+// times by their (unsigned) difference
+uint32_t timer_now     ();
+// Raise the tick every interval µs
+void     timer_periodic(uint32_t interval);
+// Raise the tick once, delta µs from now
+void     timer_oneshot (uint32_t delta);
+// Stop raising the tick
+void     timer_stop    ();
+
+// Timer1 of TIMER1 raises real-time events (releases and budgets running out)
+// at the exact time they are due, rather than on the next tick
+
+// Raise a real-time event once, delta µs from now
+void     timer_rt_oneshot(uint32_t delta);
+// Stop raising real-time events
+void     timer_rt_stop   ();
+
+/////
+////  TIMER WHEEL
+///
+// Timers live in a hierarchical wheel: level l has WHEEL_SIZE slots, each
+// WHEEL_SIZE^l jiffies wide. Adding or removing a timer is O(1), and each
+// jiffy only touches the one level 0 slot due (plus, every WHEEL_SIZE jiffies,
+// one slot of a higher level that is cascaded down), however many timers
+// there are.
+#define WHEEL_BITS   6
+#define WHEEL_SIZE   (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+// One jiffy is 2^JIFFY_SHIFT µs, ~1ms. The wheel spans ~4.7 hours
+#define JIFFY_SHIFT  10
+#define JIFFY_US     (1 << JIFFY_SHIFT)
+
+typedef struct tmr {
+  struct tmr*  next;
+  struct tmr*  prev;
+  // The slot the timer is in, or NULL if it is not pending
+  struct tmr** slot;
+  // Jiffy at which the timer fires
+  uint32_t     expires;
+  // Called from the timer interrupt when the timer fires
+  void       (*fire)(struct tmr* t);
+  void*        data;
+} tmr_t;
+
+// Fire t->fire(t) in (at least) delay µs
+void timer_add     (tmr_t* t, uint32_t delay);
+// Cancel t, if it is pending
+void timer_del     (tmr_t* t);
+// Fire every timer that is due. Call from the tick
+void timer_expire  ();
+// Put the time (per timer_now) by which the next timer may be due in at,
+// returning false if no timers are pending
+bool timer_next_due(uint32_t* at);
+
+#endif
@@ -0,0 +1,90 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "tty.h"
+
+void tty_init(tty_t* tty, PL011_t* dev) {
+    tty->dev          = dev;
+    tty->rx_reader    = 0;
+    tty->rx_writer    = 0;
+    tty->rx_count     = 0;
+    tty->lines        = 0;
+    tty->readers.head = tty->readers.tail = 0;
+    tty->tx_reader    = 0;
+    tty->tx_writer    = 0;
+    tty->tx_count     = 0;
+    tty->writers.head = tty->writers.tail = 0;
+
+    dev->ICR   = 0x7FF;  // clear anything pending
+    dev->IMSC |= 0x50;   // interrupt on RX FIFO level, and RX timeout (for
+                         // bytes left below the level). TX is only
+                         // enabled while there is something to send.
+}
+
+//A full buffer holding no newline is handed out as a line, as no more input
+//could ever complete it
+bool line_ready(tty_t* tty) {
+    return tty->lines > 0 || tty->rx_count == TTY_RX_SIZE;
+}
+
+bool tty_rx(tty_t* tty) {
+    while (PL011_can_getc(tty->dev)) {
+        char c = PL011_getc(tty->dev, false);
+        if (tty->rx_count == TTY_RX_SIZE) continue; // No room: drop it
+        tty->rx[tty->rx_writer] = c;
+        tty->rx_writer = (tty->rx_writer + 1) % TTY_RX_SIZE;
+        tty->rx_count++;
+        if (c == '\x0A') tty->lines++;
+    }
+    tty->dev->ICR = 0x50;
+    return line_ready(tty);
+}
+
+int tty_read(tty_t* tty, char* out, int nchars) {
+    if (nchars > 0 && !line_ready(tty)) return WQ_BLOCK;
+    int i = 0;
+    while (i < nchars && tty->rx_count > 0) {
+        char c = tty->rx[tty->rx_reader];
+        tty->rx_reader = (tty->rx_reader + 1) % TTY_RX_SIZE;
+        tty->rx_count--;
+        if (c == '\x0A') {
+            tty->lines--;
+            out[i] = '\0';
+            break;
+        }
+        out[i++] = c;
+    }
+    return i;
+}
+
+bool tty_tx(tty_t* tty) {
+    uint32_t before = tty->tx_count;
+    tty->dev->ICR = 0x20;
+    while (tty->tx_count > 0 && PL011_can_putc(tty->dev)) {
+        PL011_putc(tty->dev, tty->tx[tty->tx_reader], false);
+        tty->tx_reader = (tty->tx_reader + 1) % TTY_TX_SIZE;
+        tty->tx_count--;
+    }
+    if (tty->tx_count > 0) tty->dev->IMSC |=  0x20;
+    else                   tty->dev->IMSC &= ~0x20;
+    return tty->tx_count < before;
+}
+
+int tty_write(tty_t* tty, char* in, int nchars) {
+    int space = TTY_TX_SIZE - tty->tx_count;
+    if (nchars <= TTY_TX_SIZE ? space < nchars : space == 0) return WQ_BLOCK;
+    int i = 0;
+    while (i < nchars && tty->tx_count < TTY_TX_SIZE) {
+        tty->tx[tty->tx_writer] = in[i];
+        i++;
+        tty->tx_writer = (tty->tx_writer + 1) % TTY_TX_SIZE;
+        tty->tx_count++;
+    }
+    // Prime the FIFO: the TX interrupt only fires as it drains
+    tty_tx(tty);
+    return i;
+}
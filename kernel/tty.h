@@ -0,0 +1,62 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __TTY_H
+#define __TTY_H
+
+#define TTY_RX_SIZE 0x400
+#define TTY_TX_SIZE 0x1000
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "PL011.h"
+#include "waitq.h"
+
+//Kernel side of a UART: received bytes are buffered here by the RX interrupt
+//until a reader asks for them, a line at a time, and written bytes until the
+//TX interrupt says the FIFO has room for them
+typedef struct {
+  PL011_t* dev;
+  char     rx[TTY_RX_SIZE];
+  uint32_t rx_reader;
+  uint32_t rx_writer;
+  uint32_t rx_count;
+  //Complete (newline-terminated) lines in rx
+  uint32_t lines;
+  //Processes waiting for a line
+  waitq_t  readers;
+  char     tx[TTY_TX_SIZE];
+  uint32_t tx_reader;
+  uint32_t tx_writer;
+  uint32_t tx_count;
+  //Processes waiting for space in tx
+  waitq_t  writers;
+} tty_t;
+
+//Attach tty to UART dev and enable its receive interrupts
+void tty_init (tty_t* tty, PL011_t* dev);
+
+//Drain the receive FIFO into the buffer; call from the UART's interrupt.
+//Returns true iff a reader could now proceed.
+bool tty_rx (tty_t* tty);
+
+//Move as much of the buffer as will fit into the transmit FIFO, keeping the
+//TX interrupt enabled for as long as anything is left; call from the UART's
+//interrupt. Returns true iff space was freed for writers.
+bool tty_tx (tty_t* tty);
+
+//Read up to nchars of the next line, stopping at (and consuming) its newline,
+//which is replaced by '\0' and not counted. Returns the number read, or
+//WQ_BLOCK if no complete line has arrived yet.
+int  tty_read (tty_t* tty, char* out, int nchars);
+//Queue nchars for transmission, returning how many were queued. Writes of up
+//to TTY_TX_SIZE are all-or-nothing, returning WQ_BLOCK until there is space
+//for all of it; longer ones queue what fits.
+int  tty_write (tty_t* tty, char* in, int nchars);
+
+#endif
@@ -0,0 +1,279 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "slab.h"
+
+// The table walker requires 16KiB alignment
+uint32_t kernel_pt[L1_ENTRIES] __attribute__((aligned(0x4000)));
+
+// Only the first L0_ENTRIES are walked via TTBR0, and none of those are
+// per-process
+as_t kernel_as = { kernel_pt, 0, 0 };
+
+// Unique ids for address spaces
+uint32_t as_ids = 0;
+// The id of the address space each core last loaded with each ASID
+uint32_t asid_owner[NCPU][256];
+
+// Table walks are cacheable (inner and outer write-back write-allocate), so
+// see the tables through the D-cache. TTBR0 encodes this differently with
+// the multiprocessing extensions.
+#if defined( PLATFORM_PBX_A9 )
+#define TTBR_ATTR 0x4A // IRGN = 01, RGN = 01, S
+#else
+#define TTBR_ATTR 0x09 // C, RGN = 01
+#endif
+
+// TLB maintenance has to reach every core's TLB: the inner shareable
+// variants broadcast it
+#if NCPU > 1
+#define TLBIASID "mcr p15, 0, %0, c8, c3, 2 \n"
+#define TLBIMVA  "mcr p15, 0, %0, c8, c3, 1 \n"
+#else
+#define TLBIASID "mcr p15, 0, %0, c8, c7, 2 \n"
+#define TLBIMVA  "mcr p15, 0, %0, c8, c7, 1 \n"
+#endif
+// This core's TLB only
+#define TLBIASID_LOCAL "mcr p15, 0, %0, c8, c7, 2 \n"
+
+extern uint32_t _heap_start;
+
+// Pages (for process memory and TTBR0 tables) and second-level tables
+slab_t page_cache;
+slab_t l2_cache;
+
+// References to each page of the heap handed out by page_alloc
+uint16_t page_refs[HEAP_SIZE >> PAGE_SHIFT];
+
+uint16_t* refs_of(void* page) {
+  return &page_refs[((uint32_t) page - (uint32_t) &_heap_start) >> PAGE_SHIFT];
+}
+
+void flush_asid(uint8_t asid) {
+  asm volatile( "dsb \n"
+                TLBIASID
+                "dsb \n"
+                "isb \n" : : "r" (asid) : "memory" );
+}
+
+void flush_page(as_t* as, uint32_t va) {
+  asm volatile( "dsb \n"
+                TLBIMVA
+                "dsb \n"
+                "isb \n" : : "r" ((va & ~(PAGE_SIZE - 1)) | as->asid) : "memory" );
+}
+
+void map_sections(uint32_t* pt, uint32_t first, uint32_t last, uint32_t attr) {
+  for (uint32_t i = first; i <= last; ++i) 
+    pt[i] = (i << SECTION_SHIFT) | attr | L1_AP_RW | L1_SECTION;
+}
+
+void vm_init() {
+  slab_init(&page_cache, "page", PAGE_SIZE, PAGE_SIZE, 16);
+  slab_init(&l2_cache,   "l2",   L2_ENTRIES * sizeof(uint32_t),
+                                 L2_ENTRIES * sizeof(uint32_t), 4);
+  // Anything not mapped below faults, including the per-process region
+  for (int i = 0; i < L1_ENTRIES; ++i) kernel_pt[i] = 0;
+  // Low RAM alias, holding the vector table
+  map_sections(kernel_pt, 0x000, 0x0FF, L1_NORMAL);
+  // Peripherals: system registers, UARTs, timers, GIC (and on the A9, its
+  // private memory region)
+  map_sections(kernel_pt, 0x100, 0x1FF, L1_DEVICE);
+  // RAM, holding the kernel image, heap and stacks
+  map_sections(kernel_pt, RAM_BASE >> 20, (RAM_TOP >> 20) - 1, L1_NORMAL);
+}
+
+void vm_enable(bool caches) {
+  cache_invalidate();
+  mmu_flush();
+  mmu_set_dom(0, 0x1); // domain 0 => client, i.e. check AP bits
+  asm volatile( "mcr p15, 0, %0, c2, c0, 2 \n" // write TTBCR
+              : : "r" (TTBCR_N) );
+  mmu_set_ptr1((uint32_t*) ((uint32_t) kernel_pt | TTBR_ATTR));
+  as_switch(&kernel_as);
+  mmu_enable();
+  if (caches) cache_enable();
+}
+
+void* page_alloc() {
+  void* page = slab_alloc(&page_cache);
+  if (page != NULL) *refs_of(page) = 1;
+  return page;
+}
+
+//Atomic, as pages shared between processes may be written (so copied, and
+//released) on several cores at once
+void page_ref(void* page) {
+  __sync_add_and_fetch(refs_of(page), 1);
+}
+
+void page_free(void* page) {
+  if (page == NULL) return;
+  if (__sync_sub_and_fetch(refs_of(page), 1) == 0) slab_free(&page_cache, page);
+}
+
+//The walker may not look in the D-cache, so table updates are cleaned out
+//to memory before they are relied upon
+void set_entry(uint32_t* entry, uint32_t x) {
+  *entry = x;
+  cache_clean_line(entry);
+}
+
+bool as_create(as_t* as, uint8_t asid) {
+  // A TTBR0 table of L0_ENTRIES entries needs only 4KiB alignment
+  as->l1 = page_alloc();
+  if (as->l1 == NULL) return false;
+  memcpy(as->l1, kernel_pt, L0_ENTRIES * sizeof(uint32_t));
+  for (int i = 0; i < L0_ENTRIES; ++i) cache_clean_line(&as->l1[i]);
+  as->asid = asid;
+  as->id   = __sync_add_and_fetch(&as_ids, 1);
+  return true;
+}
+
+//The second-level table covering user address va, or NULL
+uint32_t* l2_of(as_t* as, uint32_t va) {
+  uint32_t l1e = as->l1[va >> SECTION_SHIFT];
+  if ((l1e & 0x3) != L1_COARSE) return NULL;
+  return (uint32_t*) (l1e & ~0x3FF);
+}
+
+void as_destroy(as_t* as) {
+  if (as->l1 == NULL) return;
+  for (uint32_t s = USER_BASE >> SECTION_SHIFT; s < L0_ENTRIES; ++s) {
+    uint32_t* l2 = l2_of(as, s << SECTION_SHIFT);
+    if (l2 == NULL) continue;
+    for (int j = 0; j < L2_ENTRIES; ++j) {
+      if (l2[j] & L2_PAGE) page_free((void*) (l2[j] & ~(PAGE_SIZE - 1)));
+    }
+    slab_free(&l2_cache, l2);
+  }
+  page_free(as->l1);
+  as->l1 = NULL;
+}
+
+bool as_fork(as_t* dst, as_t* src, uint8_t asid) {
+  if (!as_create(dst, asid)) return false;
+  for (uint32_t s = USER_BASE >> SECTION_SHIFT; s < L0_ENTRIES; ++s) {
+    uint32_t* l2 = l2_of(src, s << SECTION_SHIFT);
+    if (l2 == NULL) continue;
+    for (int j = 0; j < L2_ENTRIES; ++j) {
+      if (!(l2[j] & L2_PAGE)) continue;
+      uint32_t va   = (s << SECTION_SHIFT) | (j << PAGE_SHIFT);
+      void*    page = (void*) (l2[j] & ~(PAGE_SIZE - 1));
+      if (!as_map(dst, va, page)) {
+        as_destroy(dst);
+        return false;
+      }
+      page_ref(page);
+      // Both sides read-only: the first to write gets a copy
+      set_entry(&l2[j], l2[j] | L2_APX);
+      uint32_t* dl2 = l2_of(dst, va);
+      set_entry(&dl2[j], dl2[j] | L2_APX);
+    }
+  }
+  // src may be loaded, with writable entries cached
+  flush_asid(src->asid);
+  return true;
+}
+
+bool as_cow(as_t* as, uint32_t va) {
+  if (va < USER_BASE || va >= USER_TOP) return false;
+  uint32_t* l2 = l2_of(as, va);
+  if (l2 == NULL) return false;
+  uint32_t* pte = &l2[(va >> PAGE_SHIFT) & 0xFF];
+  // User pages are only ever read-only when shared by a fork
+  if (!(*pte & L2_PAGE) || !(*pte & L2_APX)) return false;
+
+  void* page = (void*) (*pte & ~(PAGE_SIZE - 1));
+  if (*refs_of(page) > 1) {
+    // Still shared: copy it
+    void* copy = page_alloc();
+    if (copy == NULL) return false;
+    memcpy(copy, page, PAGE_SIZE);
+    set_entry(pte, (uint32_t) copy | (*pte & (PAGE_SIZE - 1) & ~L2_APX));
+    page_free(page);
+  }
+  // Everyone else has copied it already: just take it back
+  else set_entry(pte, *pte & ~L2_APX);
+  flush_page(as, va);
+  return true;
+}
+
+bool as_map(as_t* as, uint32_t va, void* page) {
+  uint32_t* l2 = l2_of(as, va);
+  if (l2 == NULL) {
+    // Second-level tables are 1KiB, and must be aligned to that
+    l2 = slab_alloc(&l2_cache);
+    if (l2 == NULL) return false;
+    memset(l2, 0, L2_ENTRIES * sizeof(uint32_t));
+    for (int j = 0; j < L2_ENTRIES; j += 8) cache_clean_line(&l2[j]);
+    set_entry(&as->l1[va >> SECTION_SHIFT], (uint32_t) l2 | L1_COARSE);
+  }
+  // Stacks and data only: user code is in the kernel image
+  set_entry(&l2[(va >> PAGE_SHIFT) & 0xFF], 
+            (uint32_t) page | L2_NORMAL | L2_AP_RW | L2_NG | L2_XN | L2_PAGE);
+  return true;
+}
+
+void as_unmap(as_t* as, uint32_t lo, uint32_t hi) {
+  for (uint32_t va = lo; va < hi; va += PAGE_SIZE) {
+    uint32_t* l2 = l2_of(as, va);
+    if (l2 == NULL) continue;
+    uint32_t* pte = &l2[(va >> PAGE_SHIFT) & 0xFF];
+    if (!(*pte & L2_PAGE)) continue;
+    page_free((void*) (*pte & ~(PAGE_SIZE - 1)));
+    set_entry(pte, 0);
+  }
+  // It may be loaded by any core
+  flush_asid(as->asid);
+}
+
+bool as_populate(as_t* as, uint32_t va) {
+  if (as_page(as, va) != NULL) return true;
+  void* page = page_alloc();
+  if (page == NULL) return false;
+  // Whatever it last held is none of this process's business
+  memset(page, 0, PAGE_SIZE);
+  if (!as_map(as, va & ~(PAGE_SIZE - 1), page)) {
+    page_free(page);
+    return false;
+  }
+  return true;
+}
+
+void* as_page(as_t* as, uint32_t va) {
+  uint32_t* l2 = l2_of(as, va);
+  if (l2 == NULL) return NULL;
+  uint32_t l2e = l2[(va >> PAGE_SHIFT) & 0xFF];
+  return (l2e & L2_PAGE) ? (void*) (l2e & ~(PAGE_SIZE - 1)) : NULL;
+}
+
+void as_switch(as_t* as) {
+  // Entries under this ASID may belong to another address space
+  uint32_t* owner = &asid_owner[cpu_id()][as->asid];
+  if (as->asid != 0 && *owner != as->id) {
+    asm volatile( "dsb \n"
+                  TLBIASID_LOCAL
+                  "dsb \n" : : "r" (as->asid) : "memory" );
+    *owner = as->id;
+  }
+  // Changing TTBR0 and the ASID (in CONTEXTIDR) cannot be done atomically: go
+  // via the reserved ASID, which tags no entries, so that nothing walked
+  // in between is cached against the wrong one
+  asm volatile( "mcr p15, 0, %2, c13, c0, 1 \n" // write CONTEXTIDR
+                "isb                        \n"
+                "mcr p15, 0, %0, c2, c0, 0  \n" // write TTBR0
+                "isb                        \n"
+                "mcr p15, 0, %1, c13, c0, 1 \n" // write CONTEXTIDR
+                "isb                        \n"
+              : : "r" ((uint32_t) as->l1 | TTBR_ATTR), "r" (as->asid), "r" (0)
+              : "memory" );
+}
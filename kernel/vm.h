@@ -0,0 +1,135 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __VM_H
+#define __VM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "MMU.h"
+#include "smp.h"
+
+// Sections are 1MiB, so a first-level table has 4096 entries
+#define SECTION_SHIFT 20
+#define L1_ENTRIES    4096
+// Pages are 4KiB, so a second-level table has 256 entries
+#define PAGE_SHIFT    12
+#define PAGE_SIZE     (1 << PAGE_SHIFT)
+#define L2_ENTRIES    256
+
+// TTBR0 translates the bottom 1GiB of the address space (1024 entries of its
+// table), and is switched per process. TTBR1 translates the rest, the kernel.
+#define TTBCR_N       2
+#define L0_ENTRIES    (L1_ENTRIES >> TTBCR_N)
+// Per-process memory lives in [USER_BASE, USER_TOP): the same virtual
+// addresses in every process, backed by different pages
+#define USER_BASE     0x20000000
+#define USER_TOP      0x40000000
+// RAM, holding the kernel image (and with it every program's code and
+// globals), the heap and the kernel's stacks
+#define RAM_BASE      0x70000000
+#define RAM_TOP       0x90000000
+
+/* First-level descriptors, per Section B3.5.1 of
+ *
+ * http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.ddi0406c/index.html
+ */
+#define L1_COARSE     0x00001 // descriptor type: second-level table
+#define L1_SECTION    0x00002 // descriptor type: section
+#define L1_B          0x00004
+#define L1_C          0x00008
+#define L1_XN         0x00010 // execute never
+#define L1_AP_RW      0x00C00 // AP[1:0] = 11 => read/write at any privilege
+#define L1_TEX(x)     ((x) << 12)
+#define L1_S          0x10000 // shareable
+
+// Second-level (small page) descriptors
+#define L2_XN         0x001   // execute never
+#define L2_PAGE       0x002   // descriptor type: small page
+#define L2_B          0x004
+#define L2_C          0x008
+#define L2_AP_RW      0x030   // AP[1:0] = 11 => read/write at any privilege
+#define L2_APX        0x200   // AP[2] = 1, with the above => read-only at any
+                              // privilege (so kernel writes fault too)
+#define L2_TEX(x)     ((x) << 6)
+#define L2_S          0x400   // shareable
+#define L2_NG         0x800   // not global, i.e. tagged with the ASID
+
+// Normal memory, write-back write-allocate: what RAM is mapped as. With more
+// than one core it has to be shareable for the SCU to keep it coherent.
+#if NCPU > 1
+#define L1_NORMAL     (L1_TEX(1) | L1_C | L1_B | L1_S)
+#define L2_NORMAL     (L2_TEX(1) | L2_C | L2_B | L2_S)
+#else
+#define L1_NORMAL     (L1_TEX(1) | L1_C | L1_B)
+#define L2_NORMAL     (L2_TEX(1) | L2_C | L2_B)
+#endif
+// Strongly ordered: device registers are accessed exactly as, and in the
+// order, the program says
+#define L1_DEVICE     (L1_XN)
+
+// An address space: a TTBR0 table, and the ASID tagging its TLB entries.
+// There are more address spaces than ASIDs, so they may share one: each is
+// also given a unique id, and a core flushes an ASID's entries whenever it
+// loads a different address space under it than it last did.
+typedef struct {
+  uint32_t* l1;
+  uint8_t   asid;
+  uint32_t  id;
+} as_t;
+
+// The kernel's own, holding no per-process mappings (ASID 0 is reserved)
+extern as_t kernel_as;
+
+// Build the kernel's (identity) translation table. Call once, on the boot
+// core, before any core calls vm_enable.
+void vm_init();
+// Turn on the MMU (and, if caches, caches and branch prediction) on the
+// executing core, in the kernel's address space
+void vm_enable(bool caches);
+
+// Kernel pages come from the heap, whose size is fixed by image.ld
+#define HEAP_SIZE     0x01000000
+
+// Page-aligned page of kernel memory, or NULL. Pages are reference counted,
+// starting from 1: page_free drops a reference, only freeing on the last.
+void* page_alloc();
+void  page_ref  (void* page);
+void  page_free (void* page);
+
+// Data fault status (DFSR[10,3:0]) for translation faults (nothing mapped),
+// for want of a second-level table or of a page, and for a permission fault
+// on a page
+#define FAULT_TRANS_SECTION 0x05
+#define FAULT_TRANS_PAGE    0x07
+#define FAULT_PERM_PAGE     0x0F
+
+// Create an empty address space, tagged asid
+bool  as_create (as_t* as, uint8_t asid);
+// Free an address space, along with every page mapped in it. It must not be
+// loaded on any core.
+void  as_destroy(as_t* as);
+// Make dst a copy of src, tagged asid. The pages are shared, read-only,
+// until either side writes to one, when the writer gets its own copy.
+bool  as_fork   (as_t* dst, as_t* src, uint8_t asid);
+// Resolve a write fault at user address va in the loaded address space as,
+// if it was copy-on-write. Returns false if it was not (or out of memory).
+bool  as_cow    (as_t* as, uint32_t va);
+// Map page at user address va, read/write. Returns false if out of memory.
+bool  as_map    (as_t* as, uint32_t va, void* page);
+// Unmap (and free) every page in [lo, hi), which must be page-aligned
+void  as_unmap  (as_t* as, uint32_t lo, uint32_t hi);
+// Map a fresh, zeroed page at user address va, unless one is mapped already.
+// Returns false if out of memory.
+bool  as_populate(as_t* as, uint32_t va);
+// The page mapped at user address va, or NULL
+void* as_page   (as_t* as, uint32_t va);
+// Load an address space on the executing core
+void  as_switch (as_t* as);
+
+#endif
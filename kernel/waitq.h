@@ -0,0 +1,24 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __WAITQ_H
+#define __WAITQ_H
+
+struct pcb;
+
+// Returned by device/buffer operations that cannot proceed yet: the caller
+// should wait on the relevant queue and retry
+#define WQ_BLOCK (-2)
+
+// FIFO of processes blocked on some event, linked through their PCBs (a
+// blocked process is on no ready queue, so the same links serve)
+typedef struct {
+  struct pcb* head;
+  struct pcb* tail;
+} waitq_t;
+
+#endif
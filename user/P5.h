@@ -14,4 +14,6 @@
 
 #include "libc.h"
 
+int is_prime( uint32_t x );
+
 #endif
@@ -0,0 +1,150 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+// Benchmarks, timed with uclock(). Run them under kernels built with and
+// without a feature (e.g. CACHES, in kernel/hilevel.h) to compare.
+
+#include "libc.h"
+#include "xlibc.h"
+#include "strformat.h"
+#include "P5.h"
+
+#define BENCH_ROUNDS 5
+
+// P5's prime loop, once per round
+void bench_primes() {
+    int t[2];
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        uint32_t start = uclock();
+        for (uint32_t x = 1 << 8; x < 1 << 16; x++) is_prime(x);
+        t[0] = i;
+        t[1] = uclock() - start;
+        print_hex("primes round 0x@@: 0x@@@@@@@@ us\n", 33, t);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+#define PINGPONG_YIELDS 0x4000
+
+// Two processes yielding to each other, so every yield is a context switch
+// (given one core: with more, each may just keep its own). Compare kernels
+// before and after a change to the switch path.
+void bench_pingpong() {
+    int t[2];
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        int pid = fork();
+        if (pid == 0) {
+            for (int j = 0; j < PINGPONG_YIELDS; j++) yield();
+            exit(EXIT_SUCCESS);
+        }
+        uint32_t start = uclock();
+        for (int j = 0; j < PINGPONG_YIELDS; j++) yield();
+        uint32_t ms = (uclock() - start) / 1000;
+        //So that it is not still yielding into the next round
+        waitpid(pid, NULL, NULL, 0);
+        t[0] = i;
+        t[1] = ms == 0 ? 0 : 2 * PINGPONG_YIELDS * 1000 / ms;
+        print_hex("pingpong round 0x@@: 0x@@@@@@@@ switches/s\n", 43, t);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+#define FAIR_JOBS   4
+#define FAIR_WINDOW 2000000
+
+// P5's prime loop, without end
+void fair_job() {
+    while (1) {
+        for (uint32_t x = 1 << 8; x < 1 << 16; x++) is_prime(x);
+    }
+}
+
+// FAIR_JOBS copies of P5's prime loop at priorities two apart, left to
+// compete for FAIR_WINDOW us. Under the fair policy, each job's share of the
+// CPU time they got between them should match its share of their weights,
+// a level being worth 1.25x the one below. Shares are per mille. (Given one
+// core: with more, jobs only compete with those on the same one.)
+void bench_fair() {
+    int      pids[FAIR_JOBS];
+    uint32_t used[FAIR_JOBS];
+    uint32_t weights[FAIR_JOBS];
+    uint32_t total = 0, wtotal = 0, w = 0x100;
+    int      t[5];
+    for (int i = 0; i < FAIR_JOBS; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) fair_job();
+        nice(pids[i], 3 + 2 * i);
+        weights[i] = w;
+        wtotal += w;
+        w = w * 25 / 16;
+    }
+    usleep(FAIR_WINDOW);
+    for (int i = 0; i < FAIR_JOBS; i++) {
+        used[i] = cputime(pids[i]);
+        total  += used[i];
+    }
+    for (int i = 0; i < FAIR_JOBS; i++) kill(pids[i], SIG_TERM);
+
+    for (int i = 0; i < FAIR_JOBS; i++) {
+        t[0] = i;
+        t[1] = 3 + 2 * i;
+        t[2] = used[i];
+        t[3] = total == 0 ? 0 : (uint64_t) used[i] * 1000 / total;
+        t[4] = weights[i] * 1000 / wtotal;
+        print_hex("fair job 0x@@ at priority 0x@@: 0x@@@@@@@@ us, 0x@@@ per mille (weight: 0x@@@)\n", 79, t);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+#define RT_HOGS   4
+#define RT_PERIOD 10000
+#define RT_BUDGET 3000
+#define RT_WORK   2000
+#define RT_JOBS   200
+
+extern void spin_for(uint32_t us);
+
+// A periodic job of RT_WORK us every RT_PERIOD, reserved RT_BUDGET of each
+// under the EDF policy, against RT_HOGS copies of P5's prime loop. Each job
+// should finish well within its period however busy the hogs keep the
+// core(s); a reservation that would overload one should be turned down.
+void bench_rt() {
+    int      pids[RT_HOGS];
+    uint32_t worst = 0, misses = 0;
+    int      t[3];
+    for (int i = 0; i < RT_HOGS; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) fair_job();
+    }
+    t[0] = rt_reserve(RT_PERIOD, RT_PERIOD + 1, 0);
+    print_hex("overloaded reservation accepted: 0x@\n", 37, t);
+    if (!rt_reserve(RT_PERIOD, RT_BUDGET, 0)) {
+        write(STDOUT_FILENO, "Could not reserve\n", 18);
+        for (int i = 0; i < RT_HOGS; i++) kill(pids[i], SIG_TERM);
+        exit(EXIT_FAILURE);
+    }
+
+    //Released on reserving, then every period
+    uint32_t release = uclock();
+    for (int i = 0; i < RT_JOBS; i++) {
+        spin_for(RT_WORK);
+        uint32_t response = uclock() - release;
+        if (response > worst)      worst = response;
+        if (response > RT_PERIOD) misses++;
+        release += RT_PERIOD;
+        //Done with this job until the next release
+        yield();
+    }
+    rt_reserve(0, 0, 0);
+    for (int i = 0; i < RT_HOGS; i++) kill(pids[i], SIG_TERM);
+
+    t[0] = RT_JOBS;
+    t[1] = worst;
+    t[2] = misses;
+    print_hex("rt: 0x@@@@ jobs, worst response 0x@@@@@@@@ us, 0x@@@@ missed\n", 61, t);
+    exit(misses == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,47 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "mutex.h"
+#include "xlibc.h"
+
+// After Drepper, "Futexes Are Tricky": the state only goes to 2 when someone
+// may be asleep, so an unlock only wakes (enters the kernel) if it was 2.
+
+// Both compile to ldrex/strex loops, fenced with dmb for SMP.
+
+//If *x is old, make it new. Returns what *x was
+uint32_t mutex_cas(volatile uint32_t* x, uint32_t old, uint32_t new) {
+  return __sync_val_compare_and_swap(x, old, new);
+}
+
+//Make *x new. Returns what it was
+uint32_t mutex_xchg(volatile uint32_t* x, uint32_t new) {
+  return __atomic_exchange_n(x, new, __ATOMIC_SEQ_CST);
+}
+
+void mutex_init(mutex_t* m) {
+  m->state = 0;
+}
+
+void mutex_lock(mutex_t* m) {
+  uint32_t c = mutex_cas(&m->state, 0, 1);
+  if (c == 0) return;
+  //Contended: mark it so, and sleep until it is free
+  if (c != 2) c = mutex_xchg(&m->state, 2);
+  while (c != 0) {
+    futex_wait(&m->state, 2);
+    c = mutex_xchg(&m->state, 2);
+  }
+}
+
+bool mutex_trylock(mutex_t* m) {
+  return mutex_cas(&m->state, 0, 1) == 0;
+}
+
+void mutex_unlock(mutex_t* m) {
+  if (mutex_xchg(&m->state, 0) == 2) futex_wake(&m->state, 1);
+}
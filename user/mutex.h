@@ -0,0 +1,32 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
+ * which can be found via http://creativecommons.org (and should be included as 
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __MUTEX_H
+#define __MUTEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Mutexes that only make a system call when contended: taking a free one or
+// releasing one nobody waits for is a few exclusive loads and stores. One
+// in a global is shared by every process; one on the stack only by the
+// process (and anything sharing its memory).
+
+#define MUTEX_INIT { 0 }
+
+typedef struct {
+  // 0: unlocked, 1: locked, 2: locked, maybe with waiters
+  volatile uint32_t state;
+} mutex_t;
+
+void mutex_init   (mutex_t* m);
+void mutex_lock   (mutex_t* m);
+//Take m if it is free, without waiting: returns whether it was
+bool mutex_trylock(mutex_t* m);
+void mutex_unlock (mutex_t* m);
+
+#endif
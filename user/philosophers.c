@@ -8,6 +8,7 @@
 #include "libc.h"
 #include "xlibc.h"
 #include "strformat.h"
+#include "mutex.h"
 
 #define PHIL_COUNT 16
 // In this method, the 'last' philosopher will reach for their right fork
@@ -18,45 +19,44 @@
 #define  FIRST_FORK (left_first ? left_fork : right_fork)
 #define SECOND_FORK (left_first ? right_fork : left_fork)
 
-extern int is_prime(uint32_t x);
-void eat() {
-    //Use routine from P5 to take some time
-    uint32_t lo = 1 <<  8;
-    uint32_t hi = 1 << 16;
+#define EAT_TIME 200000 //µs
 
-    for( uint32_t x = lo; x < hi; x++ ) {
-        int r = is_prime( x ); 
-    }
+// Globals are shared by every process, so the philosophers (forked from the
+// spawner) all see the same forks
+mutex_t forks[PHIL_COUNT];
+
+void eat() {
+    //Block rather than burning CPU that the other philosophers could use
+    usleep(EAT_TIME);
 }
 
 // Outputs generated from the philosophers will 
-void phil_thinker(sem_id_t left_fork) {
-    sem_id_t right_fork = (left_fork == PHIL_COUNT - 1) ? 0 : left_fork + 1;
+void phil_thinker(int left_fork) {
+    int right_fork = (left_fork == PHIL_COUNT - 1) ? 0 : left_fork + 1;
 
     int left_first = left_fork < right_fork;
     while(1) {
         //Think until first fork available
         printn(" ☹ ", 5);
-        sem_wait(FIRST_FORK, 1);
+        mutex_lock(&forks[FIRST_FORK]);
         printn(left_first ? "\\☹ " : " ☹/", 5);
         
         //Think until second fork available
-        sem_wait(SECOND_FORK, 1);
+        mutex_lock(&forks[SECOND_FORK]);
         printn("\\☺/", 5);
 
         //Eat!
         eat();
         
         //Put forks down (order doesn't matter)
-        sem_post(FIRST_FORK, 1);
-        sem_post(SECOND_FORK, 1);
+        mutex_unlock(&forks[FIRST_FORK]);
+        mutex_unlock(&forks[SECOND_FORK]);
     }
 }
 
 void phil_spawner() {
     int i;
-    //Init semaphores as mutexes
-    for (i = 0; i < PHIL_COUNT; i++) sem_init(i, 1);
+    for (i = 0; i < PHIL_COUNT; i++) mutex_init(&forks[i]);
     int ps[PHIL_COUNT];
     int pfds[2];
     i = 0;
@@ -76,17 +76,21 @@ void phil_spawner() {
     // pipes.
     int n = 5 * PHIL_COUNT + 1;
     char table[n];
-    int tr; //total read
+    char buf[5 * 32];
+    int  r;
     memset(table, ' ', n-1);
     table[n-1] = '\n';
     while (1) {
-        tr = 0;
+        // Reads block until the philosopher has something to say, then
+        // return everything it has said since (whole 5-char states, as
+        // writes are atomic), of which only the latest matters. Draining the
+        // pipe keeps a philosopher from blocking on a full one with its forks
+        // in hand while we wait on another.
         for (i = 0; i < PHIL_COUNT; ++i) {
-            tr += read(ps[i], table + (5 * i), 5);
+            r = read(ps[i], buf, sizeof(buf));
+            if (r >= 5) memcpy(table + (5 * i), buf + r - 5, 5);
         }
-        if (tr > 0) write(STDOUT_FILENO, table, n);
-        // There is no point returning to the beginning of the loop yet, so
-        yield();
+        write(STDOUT_FILENO, table, n);
     }
     exit(EXIT_SUCCESS);
 }
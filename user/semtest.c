@@ -7,15 +7,11 @@
 
 #include "libc.h"
 #include "xlibc.h"
+#include "strformat.h"
 
-extern int is_prime(uint32_t x);
 void waste_time() {
-    uint32_t lo = 1 <<  8;
-    uint32_t hi = 1 << 16;
-
-    for( uint32_t x = lo; x < hi; x++ ) {
-      int r = is_prime( x ); 
-    }
+    //Hold the mutex for a while without keeping the CPU from anyone else
+    usleep(200000);
 }
 
 void main_semtest() {
@@ -46,4 +42,73 @@ void main_semtest() {
             sem_post(0 ,1);
         }
     }
-}
\ No newline at end of file
+}
+// Priority inversion: a low-priority process holds a mutex that a
+// high-priority one wants, while a middling one hogs the CPU. Prints the
+// worst wait the high-priority process saw, which priority inheritance is
+// meant to cut by boosting the holder past the hog. Compare kernels built
+// with PRIORITY_INHERITANCE on and off, on one core (with more, the holder
+// just runs on another) and under the ageing policy, `sched ages`
+// (round-robin only weights quanta by priority).
+
+#define PI_SEM    1
+#define PI_ROUNDS 5
+#define HOLD_US   50000
+#define HOG_US    500000
+
+void spin_for(uint32_t us) {
+    uint32_t start = uclock();
+    while (uclock() - start < us);
+}
+
+void main_pitest() {
+    int pfds[2];
+    int t[2];
+    uint32_t lat, worst = 0;
+    pipe(pfds);
+    sem_init(PI_SEM, 1);
+    for (int i = 0; i < PI_ROUNDS; i++) {
+        int pid = fork();
+        if (pid == 0) {
+            //Low: take the mutex and work while holding it
+            sem_wait(PI_SEM, 1);
+            spin_for(HOLD_US);
+            sem_post(PI_SEM, 1);
+            exit(EXIT_SUCCESS);
+        }
+        nice(pid, 1);
+        //Let it take the mutex
+        usleep(10000);
+
+        pid = fork();
+        if (pid == 0) {
+            //High: time the wait for the mutex
+            uint32_t start = uclock();
+            sem_wait(PI_SEM, 1);
+            lat = uclock() - start;
+            sem_post(PI_SEM, 1);
+            write(pfds[1], &lat, sizeof(lat));
+            exit(EXIT_SUCCESS);
+        }
+        nice(pid, 20);
+
+        pid = fork();
+        if (pid == 0) {
+            //Middling: hog the CPU
+            spin_for(HOG_US);
+            exit(EXIT_SUCCESS);
+        }
+        nice(pid, 10);
+
+        read(pfds[0], &lat, sizeof(lat));
+        if (lat > worst) worst = lat;
+        t[0] = i;
+        t[1] = lat;
+        print_hex("pi round 0x@@: waited 0x@@@@@@@@ us\n", 36, t);
+        //Let the hog finish before the next round
+        usleep(HOG_US);
+    }
+    t[0] = worst;
+    print_hex("pi worst wait: 0x@@@@@@@@ us\n", 29, t);
+    exit(EXIT_SUCCESS);
+}
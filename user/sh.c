@@ -39,6 +39,38 @@ void rep_op(bool outcome) {
   xputs(outcome ? "Success\n" : "Failure\n", 8);
 }
 
+void put_hex(uint32_t x) {
+    char out[10] = "0x";
+    for (int i = 0; i < 8; i++) out[9 - i] = "0123456789ABCDEF"[(x >> (4 * i)) & 0xF];
+    xputs(out, 10);
+}
+
+// Report a child that has been reaped: its PID, exit status and CPU time
+void put_reaped(int pid, int status, uint32_t us) {
+    xputs("[", 1);
+    put_hex(pid);
+    xputs("] exited ", 9);
+    put_hex(status);
+    xputs(" after ", 7);
+    put_hex(us);
+    xputs(" us\n", 4);
+}
+
+// Scheduling policies, by ID
+char* sched_names[] = { "rr", "ages", "fair", "edf" };
+#define SCHED_NAMES 4
+
+// The bandwidth group programs are started in (0, unlimited, by default), and
+// the period of those created here
+int job_group = 0;
+#define JOB_PERIOD 100000
+
+void put_group(int gid) {
+    char out[] = "group 0x0\n";
+    out[8] = "0123456789ABCDEF"[gid & 0xF];
+    xputs(out, 10);
+}
+
 bool xtool(char* cmd) {
     if (!strcmp(cmd, "exit")) {
         exit(EXIT_SUCCESS);
@@ -95,6 +127,56 @@ bool xtool(char* cmd) {
         kill(pid, s);
         return true;
     }
+    if ( 0 == strcmp(cmd, "sched")) {
+        // sched [policy [pid]]: switch every process, or just pid, to policy;
+        // with no policy, show which new processes get
+        char* name = strtok(NULL, " ");
+        char* pid  = strtok(NULL, " ");
+        if (name == NULL) {
+            char* cur = sched_names[sched(-1, -1)];
+            xputs(cur, strlen(cur));
+            xputs("\n", 1);
+            return true;
+        }
+        int pol = 0;
+        while (pol < SCHED_NAMES && strcmp(name, sched_names[pol])) pol++;
+        rep_op(pol < SCHED_NAMES 
+               && sched(pid == NULL ? -1 : atoi(pid), pol) != -1);
+        return true;
+    }
+    if ( 0 == strcmp(cmd, "group")) {
+        // group new <percent>: create a group allowed percent of a core;
+        // group rm <gid>: free one; group <gid> [pid]: move pid into group
+        // gid, or start programs in it from now on; group: show which
+        char* a = strtok(NULL, " ");
+        char* b = strtok(NULL, " ");
+        if (a == NULL) put_group(job_group);
+        else if (0 == strcmp(a, "new")) {
+            int gid = group_create(atoi(b) * (JOB_PERIOD / 100), JOB_PERIOD);
+            if (gid == -1) rep_op(false);
+            else           put_group(gid);
+        }
+        else if (0 == strcmp(a, "rm")) rep_op(group_destroy(atoi(b)));
+        else if (b != NULL) rep_op(group_join(atoi(b), atoi(a)));
+        else {
+            group_stat_t st;
+            bool exists = group_stat(atoi(a), &st);
+            if (exists) job_group = atoi(a);
+            rep_op(exists);
+        }
+        return true;
+    }
+    if ( 0 == strcmp(cmd, "wait")) {
+        // wait [pid]: block until pid (or, with none, any program started
+        // from here) finishes
+        char*    pid = strtok(NULL, " ");
+        int      status;
+        uint32_t us;
+        int r = waitpid(pid == NULL ? -1 : atoi(pid), &status, &us, 0);
+        if (r == -1) rep_op(false);
+        else         put_reaped(r, status, us);
+        return true;
+    }
     if ( 0 == strcmp(cmd, "setp")) {
         pid_t pid = atoi(strtok(NULL, " "));
         int    s  = atoi(strtok(NULL, " "));
@@ -108,23 +190,39 @@ extern void main_P3();
 extern void main_P4(); 
 extern void main_P5();
 extern void main_semtest();
+extern void main_pitest();
+extern void main_threadtest();
 extern void phil_spawner();
 extern void main_P1();
 extern void main_P2();
 extern void pipe_test();
 extern void cat(char*);
 extern void wc(char*);
+extern void semstat(char*);
+extern void groupstat(char*);
+extern void bench_primes();
+extern void bench_pingpong();
+extern void bench_fair();
+extern void bench_rt();
 
 void* xload(char* cmd) {
     if (strcmp(cmd, "cat") == 0) return &cat;
     if (strcmp(cmd, "wc") == 0) return &wc;
+    if (strcmp(cmd, "semstat") == 0) return &semstat;
+    if (strcmp(cmd, "groupstat") == 0) return &groupstat;
     if (strcmp(cmd, "P3") == 0) return &main_P3;
     if (strcmp(cmd, "P4") == 0) return &main_P4;
     if (strcmp(cmd, "P5") == 0) return &main_P5;
     if( 0 == strcmp(cmd, "phil" )) return &phil_spawner;
     if( 0 == strcmp(cmd, "sem"  )) return &main_semtest;
+    if( 0 == strcmp(cmd, "pi"   )) return &main_pitest;
+    if( 0 == strcmp(cmd, "threads")) return &main_threadtest;
     if( 0 == strcmp(cmd, "P1"   )) return &main_P1;
     if( 0 == strcmp(cmd, "P2"   )) return &main_P2;
+    if( 0 == strcmp(cmd, "bench")) return &bench_primes;
+    if( 0 == strcmp(cmd, "pingpong")) return &bench_pingpong;
+    if( 0 == strcmp(cmd, "fair" )) return &bench_fair;
+    if( 0 == strcmp(cmd, "rt"   )) return &bench_rt;
     return NULL;
 }
 
@@ -136,6 +234,8 @@ void xaction(char*cmd, char* arg, char* out) {
     }
     int pid = fork();
     if (pid == 0) {
+        // Whatever it starts stays in the group too
+        if (job_group != 0) group_join(-1, job_group);
         if(*out != '\0') {
             int f = open(out, F_WRITE | F_CREATE);
             if (f == -1) exit(EXIT_FAILURE);
@@ -154,8 +254,13 @@ void sh_main() {
     char *out;
     char x[1024];
     int lim;
+    int pid, status;
+    uint32_t us;
 
     while (1) {
+        // Report (and reap) whatever has finished since the last command
+        while ((pid = waitpid(-1, &status, &us, WNOHANG)) > 0) 
+            put_reaped(pid, status, us);
         xputs("xsh$ ", 5);
         lim = xgets(x, 1024);
 
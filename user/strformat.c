@@ -40,7 +40,7 @@ char* format_hex(char* string, int* vals) {
 }
 
 void print_hex(char* string, int nchars, int* vals) {
-    char x[nchars];
+    char x[nchars + 1];
     strcpy(x, string);
     write(STDOUT_FILENO, format_hex(x, vals), nchars);
 }
@@ -0,0 +1,56 @@
+/* Copyright (C) 2019 Jonah McPartlin
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "libc.h"
+#include "xlibc.h"
+#include "mutex.h"
+#include "strformat.h"
+
+// Threads of one process adding to a counter on the main thread's stack,
+// which a fork()ed child could not see: the total shows whether every
+// increment made it, under a mutex also on that stack.
+
+#define THREADS     4
+#define INCREMENTS  0x1000
+
+typedef struct {
+    mutex_t  lock;
+    uint32_t count;
+} counter_t;
+
+void thread_count(void* arg) {
+    counter_t* c = arg;
+    for (int i = 0; i < INCREMENTS; i++) {
+        mutex_lock(&c->lock);
+        c->count++;
+        //Give the others a chance to contend for it
+        if (i % 0x100 == 0) yield();
+        mutex_unlock(&c->lock);
+    }
+}
+
+void main_threadtest() {
+    counter_t c;
+    int tids[THREADS];
+    int t[2];
+    mutex_init(&c.lock);
+    c.count = 0;
+
+    for (int i = 0; i < THREADS; i++) {
+        tids[i] = thread_create(&thread_count, &c);
+        if (tids[i] < 0) {
+            write(STDOUT_FILENO, "Could not start thread\n", 23);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < THREADS; i++) thread_join(tids[i]);
+
+    t[0] = c.count;
+    t[1] = THREADS * INCREMENTS;
+    print_hex("threads counted 0x@@@@@@@@ of 0x@@@@@@@@\n", 41, t);
+    exit(c.count == THREADS * INCREMENTS ? EXIT_SUCCESS : EXIT_FAILURE);
+}
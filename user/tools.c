@@ -50,4 +50,51 @@ void wc(char* path) {
             exit(EXIT_SUCCESS);
         }
     }
-}
\ No newline at end of file
+}
+// semstat: Output the counters of the semaphore with the given name, or of
+// every fixed one that has been waited on
+void semstat(char* name) {
+    sem_stat_t st;
+    int v[5];
+    sem_id_t i   = 0;
+    sem_id_t end = SEM_NONE;
+    if (name != NULL && *name) {
+        i = sem_lookup(name);
+        if (i == SEM_NONE) {
+            printn("No such semaphore.\n", 19);
+            exit(EXIT_FAILURE);
+        }
+        end = i + 1;
+    }
+    for (; i != end && sem_stat(i, &st); ++i) {
+        if (!st.waits && end == SEM_NONE) continue;
+        v[0] = i; v[1] = st.value; v[2] = st.waits; v[3] = st.blocked;
+        v[4] = st.waiters;
+        print_hex("sem 0x@@: value 0x@@@@, waits 0x@@@@@@@@, blocked 0x@@@@@@@@, queued 0x@@\n", 74, v);
+    }
+    if (end != SEM_NONE) sem_destroy(i - 1);
+    exit(EXIT_SUCCESS);
+}
+
+// groupstat: Output the quota and totals of the group with the given ID, or
+// of every group there is
+void groupstat(char* gid) {
+    group_stat_t st;
+    int v[7];
+    int i   = 0;
+    int end = GROUP_MAX;
+    if (gid != NULL && *gid) {
+        i   = atoi(gid);
+        end = i + 1;
+    }
+    for (; i < end; ++i) {
+        if (!group_stat(i, &st)) {
+            if (end == i + 1) printn("No such group.\n", 15);
+            continue;
+        }
+        v[0] = i; v[1] = st.quota; v[2] = st.period; v[3] = st.members;
+        v[4] = st.usage; v[5] = st.throttled_time; v[6] = st.throttles;
+        print_hex("group 0x@@: quota 0x@@@@@@@@ per 0x@@@@@@@@ us, members 0x@@@@, used 0x@@@@@@@@ us, throttled 0x@@@@@@@@ us (0x@@@@ times)\n", 123, v);
+    }
+    exit(EXIT_SUCCESS);
+}
@@ -5,6 +5,7 @@
  * LICENSE.txt within the associated archive or repository).
  */
 
+#include "libc.h"
 #include "xlibc.h"
 
 ////////////////
@@ -34,13 +35,115 @@ void sem_post(sem_id_t sem_id, uint32_t x) {
               : "r0", "r1" );
 }
 
-void sem_wait(sem_id_t sem_id, uint32_t x) {
-  asm volatile( "mov r0, %1 \n"
-                "mov r1, %2 \n"
-                "svc %0     \n"
-              :
+bool sem_wait(sem_id_t sem_id, uint32_t x) {
+  bool success;
+  asm volatile( "mov r0, %2 \n"
+                "mov r1, %3 \n"
+                "svc %1     \n"
+                "mov %0, r0 \n"
+              : "=r" (success)
               : "I" (SEM_WAIT), "r" (sem_id), "r" (x)
               : "r0", "r1" );
+  return success;
+}
+
+sem_id_t sem_create(char* name, uint32_t init) {
+  sem_id_t id;
+  asm volatile( "mov r0, %2 \n"
+                "mov r1, %3 \n"
+                "svc %1     \n"
+                "mov %0, r0 \n"
+              : "=r" (id)
+              : "I" (SEM_CREATE), "r" (name), "r" (init)
+              : "r0", "r1" );
+  return id;
+}
+
+sem_id_t sem_lookup(char* name) {
+  sem_id_t id;
+  asm volatile( "mov r0, %2 \n"
+                "svc %1     \n"
+                "mov %0, r0 \n"
+              : "=r" (id)
+              : "I" (SEM_LOOKUP), "r" (name)
+              : "r0" );
+  return id;
+}
+
+bool sem_destroy(sem_id_t sem_id) {
+  bool success;
+  asm volatile( "mov r0, %2 \n"
+                "svc %1     \n"
+                "mov %0, r0 \n"
+              : "=r" (success)
+              : "I" (SEM_DESTROY), "r" (sem_id)
+              : "r0" );
+  return success;
+}
+
+bool sem_stat(sem_id_t sem_id, sem_stat_t* stat) {
+  bool success;
+  asm volatile( "mov r0, %2 \n"
+                "mov r1, %3 \n"
+                "svc %1     \n"
+                "mov %0, r0 \n"
+              : "=r" (success) 
+              : "I" (SEM_STAT), "r" (sem_id), "r" (stat)
+              : "r0", "r1", "memory" );
+  return success;
+}
+
+int  futex_wait(volatile uint32_t* addr, uint32_t val) {
+  int r;
+  asm volatile( "mov r0, %2 \n"
+                "mov r1, %3 \n"
+                "svc %1     \n"
+                "mov %0, r0 \n"
+              : "=r" (r) 
+              : "I" (FUTEX_WAIT), "r" (addr), "r" (val)
+              : "r0", "r1", "memory" );
+  return r;
+}
+
+int  futex_wake(volatile uint32_t* addr, int n) {
+  int r;
+  asm volatile( "mov r0, %2 \n"
+                "mov r1, %3 \n"
+                "svc %1     \n"
+                "mov %0, r0 \n"
+              : "=r" (r) 
+              : "I" (FUTEX_WAKE), "r" (addr), "r" (n)
+              : "r0", "r1", "memory" );
+  return r;
+}
+
+//Where a thread's function returns to
+static void thread_exit() {
+  exit(EXIT_SUCCESS);
+}
+
+int  thread_create(void (*fn)(void*), void* arg) {
+  int tid;
+  asm volatile( "mov r0, %2 \n"
+                "mov r1, %3 \n"
+                "mov r2, %4 \n"
+                "svc %1     \n"
+                "mov %0, r0 \n"
+              : "=r" (tid) 
+              : "I" (THREAD), "r" (fn), "r" (arg), "r" (&thread_exit)
+              : "r0", "r1", "r2" );
+  return tid;
+}
+
+bool thread_join  (int tid) {
+  bool success;
+  asm volatile( "mov r0, %2 \n"
+                "svc %1     \n"
+                "mov %0, r0 \n"
+              : "=r" (success) 
+              : "I" (JOIN), "r" (tid)
+              : "r0", "memory" );
+  return success;
 }
 
 int  open   (char* path, char flags) {
@@ -187,3 +290,120 @@ bool getwd  (char* out, int nchars) {
               : "r0", "r1" );
   return success;
 }
+
+
+void usleep (uint32_t us) {
+  asm volatile( "mov r0, %1 \n" // Put us in r0
+                "svc %0     \n" // make svc call
+              :
+              : "I" (SLEEP), "r" (us)
+              : "r0" );
+}
+
+uint32_t uclock () {
+  uint32_t us;
+  asm volatile( "svc %1     \n" // make svc call
+                "mov %0, r0 \n" // assign us = r0
+              : "=r" (us)
+              : "I" (UCLOCK)
+              : "r0" );
+  return us;
+}
+
+int  waitpid(int pid, int* status, uint32_t* cputime, int options) {
+  int r;
+  asm volatile( "mov r0, %2 \n" // Put pid in r0
+                "mov r1, %3 \n" // Put status pointer in r1
+                "mov r2, %4 \n" // Put cputime pointer in r2
+                "mov r3, %5 \n" // Put nohang in r3
+                "svc %1     \n" // make svc call
+                "mov %0, r0 \n" // assign r = r0
+              : "=r" (r)
+              : "I" (WAITPID), "r" (pid), "r" (status), "r" (cputime),
+                "r" ((options & WNOHANG) != 0)
+              : "r0", "r1", "r2", "r3", "memory" );
+  return r;
+}
+
+uint32_t cputime(int pid) {
+  uint32_t us;
+  asm volatile( "mov r0, %2 \n" // Put pid in r0
+                "svc %1     \n" // make svc call
+                "mov %0, r0 \n" // assign us = r0
+              : "=r" (us)
+              : "I" (CPUTIME), "r" (pid)
+              : "r0" );
+  return us;
+}
+
+int  sched  (int pid, int policy) {
+  int old;
+  asm volatile( "mov r0, %2 \n" // Put pid in r0
+                "mov r1, %3 \n" // Put policy in r1
+                "svc %1     \n" // make svc call
+                "mov %0, r0 \n" // assign old = r0
+              : "=r" (old)
+              : "I" (SCHED), "r" (pid), "r" (policy)
+              : "r0", "r1" );
+  return old;
+}
+
+bool rt_reserve(uint32_t period, uint32_t budget, uint32_t deadline) {
+  bool success;
+  asm volatile( "mov r0, %2 \n" // Put period in r0
+                "mov r1, %3 \n" // Put budget in r1
+                "mov r2, %4 \n" // Put deadline in r2
+                "svc %1     \n" // make svc call
+                "mov %0, r0 \n" // assign success = r0
+              : "=r" (success)
+              : "I" (RT), "r" (period), "r" (budget), "r" (deadline)
+              : "r0", "r1", "r2" );
+  return success;
+}
+
+int  group_create (uint32_t quota, uint32_t period) {
+  int gid;
+  asm volatile( "mov r0, %2 \n" // Put quota in r0
+                "mov r1, %3 \n" // Put period in r1
+                "svc %1     \n" // make svc call
+                "mov %0, r0 \n" // assign gid = r0
+              : "=r" (gid)
+              : "I" (GROUP_CREATE), "r" (quota), "r" (period)
+              : "r0", "r1" );
+  return gid;
+}
+
+bool group_join   (int pid, int gid) {
+  bool success;
+  asm volatile( "mov r0, %2 \n" // Put pid in r0
+                "mov r1, %3 \n" // Put gid in r1
+                "svc %1     \n" // make svc call
+                "mov %0, r0 \n" // assign success = r0
+              : "=r" (success)
+              : "I" (GROUP_JOIN), "r" (pid), "r" (gid)
+              : "r0", "r1" );
+  return success;
+}
+
+bool group_stat   (int gid, group_stat_t* stat) {
+  bool success;
+  asm volatile( "mov r0, %2 \n" // Put gid in r0
+                "mov r1, %3 \n" // Put stat pointer in r1
+                "svc %1     \n" // make svc call
+                "mov %0, r0 \n" // assign success = r0
+              : "=r" (success)
+              : "I" (GROUP_STAT), "r" (gid), "r" (stat)
+              : "r0", "r1", "memory" );
+  return success;
+}
+
+bool group_destroy(int gid) {
+  bool success;
+  asm volatile( "mov r0, %2 \n" // Put gid in r0
+                "svc %1     \n" // make svc call
+                "mov %0, r0 \n" // assign success = r0
+              : "=r" (success)
+              : "I" (GROUP_DESTROY), "r" (gid)
+              : "r0" );
+  return success;
+}
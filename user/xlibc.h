@@ -31,6 +31,24 @@
 #define MKDIR    0x16
 #define CHMOD    0x17
 #define GETWD    0x18
+#define SLEEP    0x19
+#define UCLOCK   0x1A
+#define SEM_STAT 0x1B
+#define FUTEX_WAIT 0x1C
+#define FUTEX_WAKE 0x1D
+#define SEM_CREATE  0x1E
+#define SEM_LOOKUP  0x1F
+#define SEM_DESTROY 0x20
+#define THREAD   0x21
+#define JOIN     0x22
+#define CPUTIME  0x23
+#define SCHED    0x24
+#define RT       0x25
+#define GROUP_CREATE  0x26
+#define GROUP_JOIN    0x27
+#define GROUP_STAT    0x28
+#define GROUP_DESTROY 0x29
+#define WAITPID  0x2A
 
 #define F_READ   0x1
 #define F_WRITE  0x2
@@ -44,8 +62,48 @@ bool sem_init(sem_id_t sem_id, uint32_t init);
 //Increment semaphore sem_id by x
 void sem_post(sem_id_t sem_id, uint32_t x);
 
-//Wait for semaphore sem_id to by ≥x, then decrement it by x and return
-void sem_wait(sem_id_t, uint32_t x);
+//Wait for semaphore sem_id to by ≥x, then decrement it by x and return true.
+//Waiters are served in the order they arrived. Returns false if there is no
+//such semaphore, or it is destroyed first.
+bool sem_wait(sem_id_t, uint32_t x);
+
+//Semaphores 0 to 31 always exist, and are shared by every program. Others
+//are created on demand, under a name by which other programs can open them.
+#define SEM_NONE ((sem_id_t) -1)
+
+//Create a semaphore called name with value init, returning its ID, or
+//SEM_NONE if there already is one (or the name is over 31 characters)
+sem_id_t sem_create (char* name, uint32_t init);
+//The ID of the semaphore called name, or SEM_NONE if there is none
+sem_id_t sem_lookup (char* name);
+//Give up the reference to sem_id from a create or lookup: the semaphore is
+//freed once every one has been
+bool     sem_destroy(sem_id_t sem_id);
+
+typedef struct {
+  uint32_t value;
+  uint32_t waiters; // Currently queued
+  uint32_t waits;   // Calls to sem_wait, ever
+  uint32_t blocked; // ... that had to queue
+  uint32_t wakeups; // Queued waiters since served by a post
+} sem_stat_t;
+
+//Read semaphore sem_id's value and contention counters into stat
+bool sem_stat(sem_id_t sem_id, sem_stat_t* stat);
+
+//Sleep until woken by futex_wake on addr, unless *addr no longer holds val.
+//Returns 0 once woken, or -1 if *addr had changed
+int  futex_wait(volatile uint32_t* addr, uint32_t val);
+//Wake up to n processes sleeping on addr, returning how many were woken
+int  futex_wake(volatile uint32_t* addr, int n);
+
+//Run fn(arg) in a new thread of this process, sharing its memory and files
+//but on a stack of its own, until fn returns or the thread calls exit.
+//Returns the thread's ID, or -1 if it could not be started.
+int  thread_create(void (*fn)(void*), void* arg);
+//Wait for thread tid of this process to finish. Returns false if it is not
+//one of this process's threads (other than the caller).
+bool thread_join  (int tid);
 
 //Attempt to open the file at the given path, returning a file descriptor or -1
 int  open   (char* path, char flags);
@@ -66,3 +124,67 @@ bool isdir  (char* path);
 bool mkfile (char* path);
 bool mkdir  (char* path);
 bool getwd  (char* out, int nchars);
+
+//Block for at least us microseconds
+void usleep (uint32_t us);
+
+//Microseconds since boot (wrapping every ~71 minutes)
+uint32_t uclock ();
+//Wait for child pid (any child, if -1) to finish, and reap it: put the
+//status it passed to exit() (EXIT_KILLED if it was killed) in status, and
+//the CPU time it had in cputime, either of which may be NULL. Returns its
+//PID, or -1 if there is no such child. With WNOHANG, returns 0 at once if
+//none has finished yet. A child that is never waited for is kept (a zombie)
+//until its parent finishes.
+#define WNOHANG     1
+#define EXIT_KILLED (-1)
+int  waitpid(int pid, int* status, uint32_t* cputime, int options);
+
+//Microseconds of CPU time process pid has had (wrapping likewise), or -1 if
+//there is no such process
+uint32_t cputime(int pid);
+
+//Scheduling policies
+#define SCHED_RR   0 // Weighted round-robin
+#define SCHED_AGES 1 // Priority ageing
+#define SCHED_FAIR 2 // Completely fair
+#define SCHED_EDF  3 // Earliest deadline first, by reservation (see rt_reserve)
+
+//Switch process pid to the given policy, or every process (and those to come)
+//if pid is -1. A policy of -1 leaves it as it is. Returns the policy it was
+//on, or -1 if there is no such process or policy. Processes under different
+//policies do not share: rr ones always run first, and fair ones last.
+int  sched  (int pid, int policy);
+
+//Make the calling process real-time: released every period us to run for up
+//to budget us, due deadline us (0 meaning period) after each release, ahead
+//of any other policy. It stops when its budget runs out, or when it yields
+//(to say its job is done), until its next release. Returns false if no core
+//has room for the reservation. A period of 0 goes back to the default policy.
+bool rt_reserve(uint32_t period, uint32_t budget, uint32_t deadline);
+
+//CPU bandwidth groups: the processes in one get at most its quota us of CPU
+//time between them every period us, past which they wait for the next
+//period. Every process starts in its parent's group; the first in group 0,
+//which is unlimited. IDs are below GROUP_MAX.
+#define GROUP_MAX 16
+
+//Create a group with the given quota (0 for unlimited) per period, returning
+//its ID, or -1 if there is no room or the quota could never be met
+int  group_create (uint32_t quota, uint32_t period);
+//Move process pid (or, if -1, the caller), and all its threads, into group gid
+bool group_join   (int pid, int gid);
+//Free group gid, provided it has no members left
+bool group_destroy(int gid);
+
+typedef struct {
+  uint32_t quota;
+  uint32_t period;
+  uint32_t members;
+  uint32_t usage;          // CPU time its members have had, ever (us)
+  uint32_t throttled_time; // Time they have spent held back by it (us)
+  uint32_t throttles;      // Times they have been
+} group_stat_t;
+
+//Read group gid's quota, members and totals into stat
+bool group_stat   (int gid, group_stat_t* stat);